@@ -1,43 +1,139 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include "allocator.h"
+#include "fileutil.h"
 #include "logging.h"
 
-Allocator::Allocator(string name, int numElements) {
+Allocator::Allocator(string name, void** array, int elementSize, int maxElements) {
   this->name = name;
-  this->numElements = numElements;
+  this->array = array;
+  this->elementSize = elementSize;
+  this->maxElements = maxElements;
+  numElements = MIN(maxElements, INITIAL_SIZE);
+  assert(*array = malloc((size_t)numElements * elementSize));
+  mapped = false;
+  growLock = NULL;
   stack = (int*)malloc(numElements * sizeof(int));
-  inUse = (bool*)malloc(numElements * sizeof(bool));
+  stamp = (byte*)calloc(numElements, 1);
+  generation = 0;
   reset();
 }
 
+int Allocator::nextSize() {
+  int n = (numElements > maxElements / 2) ? maxElements : (2 * numElements);
+  return MIN(maxElements, (n < INITIAL_SIZE) ? INITIAL_SIZE : n);
+}
+
+bool Allocator::grow(int n) {
+  // The smaller arrays first, so that a failure leaves the main one alone.
+  // Arrays that did grow are merely larger than needed.
+  int *s = (int*)realloc(stack, n * sizeof(int));
+  if (!s) {
+    return false;
+  }
+  stack = s;
+  byte *st = (byte*)realloc(stamp, n);
+  if (!st) {
+    return false;
+  }
+  stamp = st;
+  // Readers on other threads that hold growLock may be using the old array.
+  if (growLock) {
+    pthread_mutex_lock(growLock);
+  }
+  void *old = *array, *a;
+  if (mapped) {
+    if ((a = malloc((size_t)n * elementSize))) {
+      memcpy(a, *array, (size_t)numElements * elementSize);
+    }
+  } else {
+    a = realloc(*array, (size_t)n * elementSize);
+  }
+  if (a) {
+    *array = a;
+    if (mapped) {
+      // Give back the mapped pages, including those copied on write.
+      unmapPages(old, (u64)numElements * elementSize);
+      mapped = false;
+    }
+  }
+  if (growLock) {
+    pthread_mutex_unlock(growLock);
+  }
+  if (!a) {
+    return false;
+  }
+  memset(stamp + numElements, 0, n - numElements);
+  log(LOG_DEBUG, "allocator %s grew to %d elements", name.c_str(), n);
+  numElements = n;
+  return true;
+}
+
+void Allocator::setGrowLock(pthread_mutex_t *lock) {
+  growLock = lock;
+}
+
 int Allocator::alloc() {
   int result;
   if (stackSize) {
     result = stack[--stackSize];
-  } else if (firstFree < numElements) {
-    result = firstFree++;
   } else {
-    die("allocator %s is out of space", name.c_str());
-    result = 0; // please the compiler
+    if ((firstFree == numElements) &&
+        ((numElements == maxElements) || !grow(nextSize()))) {
+      die("allocator %s is out of space", name.c_str());
+    }
+    result = firstFree++;
   }
-  assert(!inUse[result]);
-  inUse[result] = true;
+  assert(stamp[result] != generation);
+  stamp[result] = generation;
   return result;
 }
 
+bool Allocator::reserve(int n, u64 *budget) {
+  int room = numElements - firstFree + stackSize;
+  if (room >= n) {
+    return true;
+  }
+  int min = numElements + n - room;
+  if (min > maxElements) {
+    return false;
+  }
+  u64 perElement = elementSize + sizeof(int) + 1;
+  int target = MAX(nextSize(), min);
+  if (budget && ((u64)(target - numElements) * perElement > *budget)) {
+    // Grow as much as the budget allows. Memory is never given back, so if
+    // that is not enough, it never will be. Stop growing altogether.
+    target = numElements + *budget / perElement;
+    if (target < min) {
+      maxElements = numElements;
+      return false;
+    }
+  }
+  u64 cost = (u64)(target - numElements) * perElement;
+  if (!grow(target)) {
+    log(LOG_WARNING, "allocator %s cannot grow to %d elements", name.c_str(), target);
+    return false;
+  }
+  if (budget) {
+    *budget -= cost;
+  }
+  return true;
+}
+
 void Allocator::free(int index) {
   assert(stackSize < numElements);
   assert(index >= 0);
   assert(index < numElements);
-  assert(inUse[index]);
-  inUse[index] = false;
+  assert(stamp[index] == generation);
+  stamp[index] = 0;
   // log(LOG_DEBUG, "freed %s %d", name.c_str(), index);
   stack[stackSize++] = index;
 }
 
 bool Allocator::isInUse(int index) {
-  return inUse[index];
+  return stamp[index] == generation;
 }
 
 int Allocator::used() {
@@ -46,14 +142,43 @@ int Allocator::used() {
 
 int Allocator::available() {
   // There are two types of free elements: those never yet allocated (from
-  // firstFree to numElements), and those previously freed, sitting on the
+  // firstFree to maxElements), and those previously freed, sitting on the
   // stack.
-  return numElements - firstFree + stackSize;
+  return maxElements - firstFree + stackSize;
+}
+
+int Allocator::capacity() {
+  return maxElements;
+}
+
+u64 Allocator::memory() {
+  return (u64)numElements * (elementSize + sizeof(int) + 1);
+}
+
+int Allocator::highWater() {
+  return firstFree;
+}
+
+void Allocator::adopt(void* data, int count) {
+  assert(count <= maxElements);
+  if (!mapped) {
+    ::free(*array);
+  }
+  *array = data;
+  mapped = true;
+  numElements = firstFree = count;
+  stackSize = 0;
+  assert(stack = (int*)realloc(stack, (count + 1) * sizeof(int)));
+  assert(stamp = (byte*)realloc(stamp, count + 1));
+  memset(stamp, generation, count);
 }
 
 void Allocator::reset() {
-  for (int i = 0; i < numElements; i++) {
-    inUse[i] = false;
+  // Stamps from older generations read as free. Wipe them only when the
+  // generation counter wraps around.
+  if (!++generation) {
+    memset(stamp, 0, numElements);
+    generation = 1;
   }
   firstFree = 0;
   stackSize = 0;
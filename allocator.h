@@ -1,35 +1,79 @@
 #ifndef ALLOCATOR_H
 #define ALLOCATOR_H
 
+#include <pthread.h>
 #include <string>
 #include "defines.h"
 
 /**
- * A class that manages indices in a previously allocated array. Deallocated
- * elements are stacked for reuse. Does not perform boundary checks.
+ * A class that manages indices in an array. Deallocated elements are stacked
+ * for reuse. The array starts small and is grown with realloc() on demand, up
+ * to a maximum size, so callers must not keep pointers into it across calls
+ * to alloc(). Indices are stamped with the generation in which they were
+ * allocated, so reset() only has to start a new generation. Does not perform
+ * boundary checks.
  */
 class Allocator {
 
+  /* Initial number of elements, unless the maximum is lower. */
+  static const int INITIAL_SIZE = 1 << 16;
+
   string name;     // a human-readable string to be used in error messages
-  int numElements; // number of elements to accommodate
+  void** array;    // pointer to the caller's array pointer
+  int elementSize; // size of an array element in bytes
+  int numElements; // number of elements the array currently has room for
+  int maxElements; // number of elements beyond which the array cannot grow
   int firstFree;   // first index that has never been allocated
+  bool mapped;     // true iff the array belongs to a file mapping, see adopt()
   int* stack;      // stack of deallocated indices
-  bool* inUse;     // keeps track of allocated indices
+  byte* stamp;     // generation of allocated indices; other values mean free
+  byte generation; // current generation, never 0
   int stackSize;   // number of deallocated indices
+  pthread_mutex_t* growLock; // held while the array moves, or NULL
+
+  /* Returns the size of the next growth: double, up to maxElements. */
+  int nextSize();
+
+  /**
+   * Grows the array to n elements. A mapped array is copied.
+   * @return False if memory runs out. The array is then left as it was.
+   */
+  bool grow(int n);
 
 public:
   /**
+   * Allocates the array and stores it in *array.
    * @param name A human-readable name.
-   * @param numElements Number of elements to manage.
+   * @param array Pointer to the array pointer, updated when the array grows.
+   * @param elementSize Size of an array element in bytes.
+   * @param maxElements Maximum number of elements to manage.
    */
-  Allocator(string name, int numElements);
+  Allocator(string name, void** array, int elementSize, int maxElements);
 
   /**
-   * Returns the index of a free element. Terminates the program if there are no
-   * free slots.
+   * Makes growth hold the given mutex while the array moves, so that other
+   * threads can read the array safely while they hold it too.
+   */
+  void setGrowLock(pthread_mutex_t *lock);
+
+  /**
+   * Returns the index of a free element, growing the array if needed.
+   * Terminates the program if there are no free slots. Callers that need to
+   * stop cleanly instead should call reserve() beforehand.
    */
   int alloc();
 
+  /**
+   * Grows the array, if needed, so that the next n calls to alloc() don't
+   * have to.
+   * @param budget If not NULL, the growth may take at most this many bytes,
+   * which are deducted from it. If the budget is too small, the array stops
+   * growing for good.
+   * @return False if the array cannot grow that much, because of
+   * maxElements, the budget or the available memory.
+   */
+  bool reserve(int n, u64 *budget);
+
   /**
    * Marks the given index as free, making it available for reuse. Does not
    * perform sanity checks.
@@ -47,12 +91,34 @@ public:
   int used();
 
   /**
-   * Returns the number of free elements.
+   * Returns the number of free elements, including those the array can still
+   * grow into.
    */
   int available();
 
   /**
-   * Resets the allocator to an empty state.
+   * Returns the maximum number of elements managed.
+   */
+  int capacity();
+
+  /* Returns the memory currently allocated, in bytes. */
+  u64 memory();
+
+  /**
+   * Returns one past the highest index allocated since the last reset.
+   */
+  int highWater();
+
+  /**
+   * Replaces the array with one whose first count elements are all in use,
+   * part of a file mapping. It is copied when it needs to grow, and then the
+   * pages it occupies alone are unmapped.
+   */
+  void adopt(void* data, int count);
+
+  /**
+   * Resets the allocator to an empty state in constant time (amortized).
+   * Keeps the array at its current size.
    */
   void reset();
 
@@ -0,0 +1,177 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "block_allocator.h"
+#include "fileutil.h"
+#include "logging.h"
+
+BlockAllocator::BlockAllocator(string name, void** array, int elementSize,
+                               int maxElements, int maxBlockSize) {
+  this->name = name;
+  this->array = array;
+  this->elementSize = elementSize;
+  this->maxElements = maxElements;
+  this->maxBlockSize = maxBlockSize;
+  numElements = MIN(maxElements, INITIAL_SIZE);
+  assert(*array = malloc((size_t)numElements * elementSize));
+  mapped = false;
+  growLock = NULL;
+  freeBlocks.resize(maxBlockSize + 1);
+  reset();
+}
+
+int BlockAllocator::nextSize() {
+  int n = (numElements > maxElements / 2) ? maxElements : (2 * numElements);
+  return MIN(maxElements, (n < INITIAL_SIZE) ? INITIAL_SIZE : n);
+}
+
+bool BlockAllocator::grow(int n) {
+  // Readers on other threads that hold growLock may be using the old array.
+  if (growLock) {
+    pthread_mutex_lock(growLock);
+  }
+  void *old = *array, *a;
+  if (mapped) {
+    if ((a = malloc((size_t)n * elementSize))) {
+      memcpy(a, *array, (size_t)numElements * elementSize);
+    }
+  } else {
+    a = realloc(*array, (size_t)n * elementSize);
+  }
+  if (a) {
+    *array = a;
+    if (mapped) {
+      // Give back the mapped pages, including those copied on write.
+      unmapPages(old, (u64)numElements * elementSize);
+      mapped = false;
+    }
+  }
+  if (growLock) {
+    pthread_mutex_unlock(growLock);
+  }
+  if (!a) {
+    return false;
+  }
+  log(LOG_DEBUG, "allocator %s grew to %d elements", name.c_str(), n);
+  numElements = n;
+  return true;
+}
+
+void BlockAllocator::setGrowLock(pthread_mutex_t *lock) {
+  growLock = lock;
+}
+
+int BlockAllocator::alloc(int size) {
+  assert(size > 0 && size <= maxBlockSize);
+  if (!freeBlocks[size].empty()) {
+    int result = freeBlocks[size].back();
+    freeBlocks[size].pop_back();
+    numFreed -= size;
+    return result;
+  }
+
+  if ((firstFree + size > numElements) && (numElements < maxElements)) {
+    grow(MAX(nextSize(), MIN(maxElements, firstFree + size)));
+  }
+  if (firstFree + size <= numElements) {
+    int result = firstFree;
+    firstFree += size;
+    return result;
+  }
+
+  // The array is at its maximum size. Split the smallest larger block and
+  // keep the remainder.
+  for (int s = size + 1; s <= maxBlockSize; s++) {
+    if (!freeBlocks[s].empty()) {
+      int result = freeBlocks[s].back();
+      freeBlocks[s].pop_back();
+      freeBlocks[s - size].push_back(result + size);
+      numFreed -= size;
+      return result;
+    }
+  }
+
+  // Free space may remain, but only in blocks that are too small.
+  return NIL;
+}
+
+void BlockAllocator::free(int start, int size) {
+  assert(start >= 0);
+  assert(start + size <= firstFree);
+  freeBlocks[size].push_back(start);
+  numFreed += size;
+}
+
+bool BlockAllocator::reserve(int n, u64 *budget) {
+  int min = firstFree + n;
+  if (min <= numElements) {
+    return true;
+  }
+  if (min <= maxElements) {
+    int target = MAX(nextSize(), min);
+    if (budget && ((u64)(target - numElements) * elementSize > *budget)) {
+      // Grow as much as the budget allows. Memory is never given back, so if
+      // that is not enough, it never will be. Stop growing altogether, so
+      // that alloc() stays within the budget too.
+      target = numElements + *budget / elementSize;
+      if (target < min) {
+        maxElements = numElements;
+      }
+    }
+    if (target >= min) {
+      u64 cost = (u64)(target - numElements) * elementSize;
+      if (grow(target)) {
+        if (budget) {
+          *budget -= cost;
+        }
+        return true;
+      }
+      log(LOG_WARNING, "allocator %s cannot grow to %d elements", name.c_str(), target);
+      maxElements = numElements;
+    }
+  }
+
+  // The array cannot grow, but alloc() can still split a large enough block.
+  for (int s = n; s <= maxBlockSize; s++) {
+    if (!freeBlocks[s].empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int BlockAllocator::used() {
+  return firstFree - numFreed;
+}
+
+int BlockAllocator::available() {
+  return maxElements - firstFree + numFreed;
+}
+
+int BlockAllocator::capacity() {
+  return maxElements;
+}
+
+u64 BlockAllocator::memory() {
+  return (u64)numElements * elementSize;
+}
+
+void BlockAllocator::adopt(void* data, int count) {
+  assert(count <= maxElements);
+  if (!mapped) {
+    ::free(*array);
+  }
+  *array = data;
+  mapped = true;
+  reset();
+  numElements = firstFree = count;
+}
+
+void BlockAllocator::reset() {
+  for (auto &v: freeBlocks) {
+    v.clear();
+  }
+  firstFree = 0;
+  numFreed = 0;
+}
@@ -0,0 +1,117 @@
+#ifndef BLOCK_ALLOCATOR_H
+#define BLOCK_ALLOCATOR_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "defines.h"
+
+/**
+ * A class that manages blocks of consecutive indices in an array. Blocks are
+ * allocated from the end of the used area, growing the array with realloc()
+ * as needed, like Allocator does. Deallocated blocks are stacked by size for
+ * reuse. When the array cannot grow any further, larger free blocks are
+ * split. Does not perform boundary checks.
+ */
+class BlockAllocator {
+
+  /* Initial number of elements, unless the maximum is lower. */
+  static const int INITIAL_SIZE = 1 << 16;
+
+  string name;       // a human-readable string to be used in error messages
+  void** array;      // pointer to the caller's array pointer
+  int elementSize;   // size of an array element in bytes
+  int numElements;   // number of elements the array currently has room for
+  int maxElements;   // number of elements beyond which the array cannot grow
+  bool mapped;       // true iff the array belongs to a file mapping, see adopt()
+  int maxBlockSize;  // largest block size that will be requested
+  int firstFree;     // first index that has never been allocated
+  int numFreed;      // total size of the deallocated blocks
+  vector<vector<int>> freeBlocks; // deallocated blocks, by size
+  pthread_mutex_t* growLock; // held while the array moves, or NULL
+
+  /* Returns the size of the next growth: double, up to maxElements. */
+  int nextSize();
+
+  /**
+   * Grows the array to n elements. A mapped array is copied.
+   * @return False if memory runs out. The array is then left as it was.
+   */
+  bool grow(int n);
+
+public:
+  /**
+   * Allocates the array and stores it in *array.
+   * @param name A human-readable name.
+   * @param array Pointer to the array pointer, updated when the array grows.
+   * @param elementSize Size of an array element in bytes.
+   * @param maxElements Maximum number of elements to manage.
+   * @param maxBlockSize Largest block size that will be requested.
+   */
+  BlockAllocator(string name, void** array, int elementSize, int maxElements,
+                 int maxBlockSize);
+
+  /**
+   * Makes growth hold the given mutex while the array moves, so that other
+   * threads can read the array safely while they hold it too.
+   */
+  void setGrowLock(pthread_mutex_t *lock);
+
+  /**
+   * Returns the first index of a free block of the given size, or NIL if
+   * there is no room. Deallocated blocks are never merged, so this can fail
+   * even if available() is much larger than size.
+   */
+  int alloc(int size);
+
+  /**
+   * Marks a block previously returned by alloc(size) as free. Does not
+   * perform sanity checks.
+   */
+  void free(int start, int size);
+
+  /**
+   * Grows the array, if needed, so that the next call to alloc() with a size
+   * up to n succeeds without growing it. Once the array cannot grow, a free
+   * block of size n or more will do.
+   * @param budget If not NULL, the growth may take at most this many bytes,
+   * which are deducted from it. If the budget is too small, the array stops
+   * growing for good.
+   * @return False if there is no such room.
+   */
+  bool reserve(int n, u64 *budget);
+
+  /**
+   * Returns the number of used elements.
+   */
+  int used();
+
+  /**
+   * Returns the number of free elements, including those in deallocated
+   * blocks.
+   */
+  int available();
+
+  /**
+   * Returns the maximum number of elements managed.
+   */
+  int capacity();
+
+  /* Returns the memory currently allocated, in bytes. */
+  u64 memory();
+
+  /**
+   * Replaces the array with one whose first count elements are all in use,
+   * part of a file mapping. See Allocator::adopt().
+   */
+  void adopt(void* data, int count);
+
+  /**
+   * Resets the allocator to an empty state. Keeps the array at its current
+   * size.
+   */
+  void reset();
+
+};
+
+#endif
@@ -3,17 +3,19 @@
 #include <time.h>
 #include <unistd.h>
 #include "configfile.h"
+#include "dfpn.h"
 #include "egtb.h"
 #include "fileutil.h"
 #include "logging.h"
 #include "pns.h"
 #include "precomp.h"
 #include "queryserver.h"
+#include "stringutil.h"
 #include "zobrist.h"
 
 void setCommand(int *oldCmd, int newCmd) {
   if (*oldCmd) {
-    die("Only one command out of -a and -s may be given.");
+    die("Only one command out of -a, -b, -c, -e, -r, -s and -t may be given.");
   }
   *oldCmd = newCmd;
 }
@@ -27,11 +29,11 @@ int main(int argc, char **argv) {
   initEgtb();
   zobristInit();
 
-  string bookFile = cfgBookFile, position = "";
+  string bookFile = cfgBookFile, position = "", combo = "", outFile = "";
   int command = 0;
   int opt;
   opterr = 0; // Suppresses error messages from getopt()
-  while ((opt = getopt(argc, argv, "a:f:s")) != -1) {
+  while ((opt = getopt(argc, argv, "a:b:c:e:f:r:st:")) != -1) {
     switch (opt) {
       case 'f':
         bookFile = optarg;
@@ -40,16 +42,68 @@ int main(int argc, char **argv) {
         setCommand(&command, CMD_ANALYZE);
         position = optarg;
         break;
+      case 'b':
+        setCommand(&command, CMD_BENCHMARK);
+        combo = optarg;
+        break;
+      case 'c':
+        setCommand(&command, CMD_CONVERT);
+        outFile = optarg;
+        break;
+      case 'e':
+        setCommand(&command, CMD_HUFFMAN);
+        combo = optarg;
+        break;
+      case 'r':
+        setCommand(&command, CMD_REBLOCK);
+        combo = optarg;
+        break;
       case 's':
         setCommand(&command, CMD_SERVER);
         break;
+      case 't':
+        setCommand(&command, CMD_STATS);
+        combo = optarg;
+        break;
       default:
         die("Unknown switch -%c", optopt);
      }
   }
 
-  Pns pn1(60000, 10000000);
-  Pns pn2(10000000, 100000000, &pn1, bookFile);
+  // EGTB maintenance commands don't need the book
+  if (command == CMD_BENCHMARK) {
+    benchmarkEgtbBlockSizes(combo.c_str());
+    return 0;
+  }
+  if (command == CMD_STATS) {
+    logEgtbStatistics(combo.c_str());
+    return 0;
+  }
+  if (command == CMD_REBLOCK) {
+    // Argument format: COMBO:BLOCK_SIZE
+    char *arg = (char*)combo.c_str();
+    char *blockSize = split(arg, ':');
+    if (!blockSize || atoi(blockSize) <= 0) {
+      die("Usage: -r COMBO:BLOCK_SIZE");
+    }
+    reblockEgtb(arg, atoi(blockSize));
+    return 0;
+  }
+  if (command == CMD_HUFFMAN) {
+    // Argument format: COMBO[:BLOCK_SIZE]
+    char *arg = (char*)combo.c_str();
+    char *blockSize = split(arg, ':');
+    if (blockSize && atoi(blockSize) <= 0) {
+      die("Usage: -e COMBO[:BLOCK_SIZE]");
+    }
+    convertEgtbToHuffman(arg, blockSize ? atoi(blockSize) : EGTB_HUFFMAN_BLOCK_SIZE);
+    return 0;
+  }
+
+  Pn1Searcher *pn1 = (cfgPn1Engine == "dfpn")
+    ? (Pn1Searcher*)new Dfpn(cfgDfpnNodes, cfgDfpnMemory)
+    : (Pn1Searcher*)new Pns(cfgPn1Nodes, 0);
+  Pns pn2(INFTY, cfgPn2Memory, pn1, bookFile);
   QueryServer qs(&pn2);
   pn2.load();
 
@@ -62,6 +116,9 @@ int main(int argc, char **argv) {
     case CMD_SERVER:
       qs.startSync();
       break;
+    case CMD_CONVERT:
+      pn2.convert(outFile);
+      break;
     default:
       log(LOG_WARNING, "No command given. Resuming main() execution.");
   }
@@ -72,5 +129,6 @@ int main(int argc, char **argv) {
   // compressEgtb(table);
   // generateAllEgtb(2, 2);
 
+  saveEgtbHeat();
   log(LOG_DEBUG, "shutting down");
 }
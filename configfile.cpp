@@ -3,15 +3,39 @@
 #include <string.h>
 #include <unistd.h>
 #include "configfile.h"
+#include "defines.h"
 #include "stringutil.h"
 
 int cfgEgtbChunks;
+int cfgEgtbPreload;
+int cfgEgtbMmap;
+string cfgEgtbPinned;
+string cfgEgtbHeatFile;
+int cfgEgtbPinChunks;
+int cfgEgtbProbeCache;
+int cfgEgtbCaptureDepth;
 string cfgEgtbPath;
 string cfgLogFile;
 int cfgLogLevel;
 int cfgQueryServerPort;
 string cfgBookFile;
 int cfgSaveEvery;
+int cfgJournalSyncEvery;
+int cfgBackgroundSave;
+int cfgBackgroundSaveTimeout = 3600;
+int cfgVerifyLevel = VERIFY_FULL;
+int cfgVerifySampleNodes = 100000;
+
+/* Names of the verification levels, indexed by VERIFY_* */
+const char* VERIFY_LEVEL_NAMES[] = { "off", "sampled", "incremental", "full" };
+int cfgPn2Threads;
+int cfgPn1Threads = 1;
+int cfgPn1Nodes = 60000;
+int cfgPn1SolvedCache;
+string cfgPn1Engine = "pns";
+int cfgDfpnNodes = 60000;
+int cfgDfpnMemory = 64;
+int cfgPn2Memory;
 
 void loadConfigFile(const char *fileName) {
   char path[1000];
@@ -40,6 +64,20 @@ void loadConfigFile(const char *fileName) {
       value = unquote(value);
       if (!strcmp(key, "egtbChunks")) {
         cfgEgtbChunks = atoi(value);
+      } else if (!strcmp(key, "egtbPreload")) {
+        cfgEgtbPreload = atoi(value);
+      } else if (!strcmp(key, "egtbMmap")) {
+        cfgEgtbMmap = atoi(value);
+      } else if (!strcmp(key, "egtbPinned")) {
+        cfgEgtbPinned = string(value);
+      } else if (!strcmp(key, "egtbHeatFile")) {
+        cfgEgtbHeatFile = string(value);
+      } else if (!strcmp(key, "egtbPinChunks")) {
+        cfgEgtbPinChunks = atoi(value);
+      } else if (!strcmp(key, "egtbProbeCache")) {
+        cfgEgtbProbeCache = atoi(value);
+      } else if (!strcmp(key, "egtbCaptureDepth")) {
+        cfgEgtbCaptureDepth = atoi(value);
       } else if (!strcmp(key, "egtbPath")) {
         cfgEgtbPath = string(value);
       } else if (!strcmp(key, "logFile")) {
@@ -52,6 +90,40 @@ void loadConfigFile(const char *fileName) {
         cfgBookFile = string(value);
       } else if (!strcmp(key, "saveEvery")) {
         cfgSaveEvery = atoi(value);
+      } else if (!strcmp(key, "journalSyncEvery")) {
+        cfgJournalSyncEvery = atoi(value);
+      } else if (!strcmp(key, "backgroundSave")) {
+        cfgBackgroundSave = atoi(value);
+      } else if (!strcmp(key, "backgroundSaveTimeout")) {
+        cfgBackgroundSaveTimeout = atoi(value);
+      } else if (!strcmp(key, "verifyLevel")) {
+        cfgVerifyLevel = VERIFY_OFF;
+        while (strcmp(value, VERIFY_LEVEL_NAMES[cfgVerifyLevel])) {
+          cfgVerifyLevel++;
+          assert(cfgVerifyLevel <= VERIFY_FULL); // unknown level
+        }
+      } else if (!strcmp(key, "verifySampleNodes")) {
+        cfgVerifySampleNodes = atoi(value);
+      } else if (!strcmp(key, "pn2Threads")) {
+        cfgPn2Threads = atoi(value);
+      } else if (!strcmp(key, "pn1Threads")) {
+        cfgPn1Threads = atoi(value);
+        assert(cfgPn1Threads > 0);
+      } else if (!strcmp(key, "pn1Nodes")) {
+        cfgPn1Nodes = atoi(value);
+      } else if (!strcmp(key, "pn1SolvedCache")) {
+        cfgPn1SolvedCache = atoi(value);
+      } else if (!strcmp(key, "pn1Engine")) {
+        cfgPn1Engine = string(value);
+        assert(cfgPn1Engine == "pns" || cfgPn1Engine == "dfpn");
+      } else if (!strcmp(key, "dfpnNodes")) {
+        cfgDfpnNodes = atoi(value);
+        assert(cfgDfpnNodes > 0);
+      } else if (!strcmp(key, "dfpnMemory")) {
+        cfgDfpnMemory = atoi(value);
+        assert(cfgDfpnMemory > 0);
+      } else if (!strcmp(key, "pn2Memory")) {
+        cfgPn2Memory = atoi(value);
       }
     }
   }
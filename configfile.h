@@ -4,12 +4,32 @@
 using namespace std;
 
 extern int cfgEgtbChunks;
+extern int cfgEgtbPreload;
+extern int cfgEgtbMmap;
+extern string cfgEgtbPinned;
+extern string cfgEgtbHeatFile;
+extern int cfgEgtbPinChunks;
+extern int cfgEgtbProbeCache;
+extern int cfgEgtbCaptureDepth;
 extern string cfgEgtbPath;
 extern string cfgLogFile;
 extern int cfgLogLevel;
 extern int cfgQueryServerPort;
 extern string cfgBookFile;
 extern int cfgSaveEvery;
+extern int cfgJournalSyncEvery;
+extern int cfgBackgroundSave;
+extern int cfgBackgroundSaveTimeout;
+extern int cfgVerifyLevel;
+extern int cfgVerifySampleNodes;
+extern int cfgPn2Threads;
+extern int cfgPn1Threads;
+extern int cfgPn1Nodes;
+extern int cfgPn1SolvedCache;
+extern string cfgPn1Engine;
+extern int cfgDfpnNodes;
+extern int cfgDfpnMemory;
+extern int cfgPn2Memory;
 
 /* Loads options from an INI file. Exits on errors. */
 void loadConfigFile(const char *fileName);
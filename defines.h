@@ -97,9 +97,20 @@ using namespace std;
 #define FORWARD true
 #define BACKWARD false
 
-/* Cache EGTB files in 32 KB chunks */
+/* Compress and cache EGTB files in 32 KB chunks, unless the table's index file
+ * records a different block size */
 #define EGTB_CHUNK_SIZE 32768
 
+/* Index files that record their block size start with this value. Older index
+ * files start directly with the offset of block 0, which is always 12. */
+#define EGTB_IDX_MAGIC 0x78646943
+
+/* Default number of positions per block in Huffman-coded tables */
+#define EGTB_HUFFMAN_BLOCK_SIZE 1024
+
+/* Time to spend decoding random blocks when benchmarking a block size, in milliseconds */
+#define EGTB_BENCHMARK_MS 500
+
 /* The square between 0 and 63 corresponding to a rank and file between 0 and 7 */
 #define SQUARE(rank, file) (((rank) << 3) + (file))
 
@@ -123,11 +134,28 @@ using namespace std;
      __typeof__ (b) _b = (b); \
      _a < _b ? _a : _b; })
 
+#define MAX(a,b) \
+  ({ __typeof__ (a) _a = (a); \
+     __typeof__ (b) _b = (b); \
+     _a > _b ? _a : _b; })
+
 /* Commands given from the command line */
 #define CMD_ANALYZE 1
 #define CMD_SERVER 2
+#define CMD_REBLOCK 3
+#define CMD_BENCHMARK 4
+#define CMD_HUFFMAN 5
+#define CMD_STATS 6
+#define CMD_CONVERT 7
+
+/* Book verification levels, see the verifyLevel option */
+#define VERIFY_OFF 0
+#define VERIFY_SAMPLED 1
+#define VERIFY_INCREMENTAL 2
+#define VERIFY_FULL 3
 
 typedef unsigned long long u64;
+typedef unsigned u32;
 typedef unsigned short u16;
 typedef unsigned char byte;
 
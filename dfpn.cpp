@@ -0,0 +1,255 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitmanip.h"
+#include "board.h"
+#include "configfile.h"
+#include "dfpn.h"
+#include "egtb.h"
+#include "logging.h"
+#include "movegen.h"
+#include "zobrist.h"
+
+/* Prints a (dis)proof number for logging. */
+string dfpnNumber(u64 x) {
+  return (x == INFTY64) ? "∞" : to_string(x);
+}
+
+Dfpn::Dfpn(int maxNodes, int sizeMb) {
+  this->maxNodes = maxNodes;
+  this->sizeMb = sizeMb;
+  u64 numBuckets = 1;
+  while (numBuckets * 2 * BUCKET_SIZE * sizeof(DfpnEntry) <= ((u64)sizeMb << 20)) {
+    numBuckets *= 2;
+  }
+  mask = numBuckets - 1;
+  assert(table = (DfpnEntry*)calloc(numBuckets * BUCKET_SIZE, sizeof(DfpnEntry)));
+  generation = 0;
+  numNodes = numExpansions = numRootMoves = 0;
+  rootProof = rootDisproof = 1;
+}
+
+Dfpn::~Dfpn() {
+  free(table);
+}
+
+bool Dfpn::isLive(DfpnEntry *e) {
+  return e->key &&
+    ((e->generation == generation) || !(u64)e->proof || !(u64)e->disproof);
+}
+
+DfpnEntry* Dfpn::find(u64 key) {
+  DfpnEntry *bucket = &table[(key & mask) * BUCKET_SIZE];
+  for (int i = 0; i < BUCKET_SIZE; i++) {
+    if (bucket[i].key == key) {
+      DfpnEntry *e = &bucket[i];
+      bool valid = isLive(e) && (!e->dependency || path.count(e->dependency));
+      return valid ? e : NULL;
+    }
+  }
+  return NULL;
+}
+
+void Dfpn::store(u64 key, u64 proof, u64 disproof, u32 work, u64 dependency) {
+  DfpnEntry *bucket = &table[(key & mask) * BUCKET_SIZE];
+  DfpnEntry *e = NULL;
+  for (int i = 0; !e && (i < BUCKET_SIZE); i++) {
+    if (bucket[i].key == key) {
+      e = &bucket[i];
+    }
+  }
+  for (int i = 0; !e && (i < BUCKET_SIZE); i++) {
+    if (!isLive(&bucket[i])) {
+      e = &bucket[i];
+    }
+  }
+  if (!e) {
+    e = bucket;
+    for (int i = 1; i < BUCKET_SIZE; i++) {
+      if (bucket[i].work < e->work) {
+        e = &bucket[i];
+      }
+    }
+  }
+  e->key = key;
+  e->dependency = (proof && disproof) ? dependency : 0; // wins and losses hold on any path
+  e->proof = proof;
+  e->disproof = disproof;
+  e->work = work;
+  e->generation = generation;
+}
+
+bool Dfpn::evaluate(Board *b, u64 *proof, u64 *disproof) {
+  Board c = *b; // the lookup clobbers it
+  int numPieces = popCount(b->bb[BB_WALL]) + popCount(b->bb[BB_BALL]);
+  int score = (numPieces > EGTB_MEN)
+    ? egtbLookupExtended(&c, cfgEgtbCaptureDepth)
+    : egtbLookup(&c);
+  if (score != EGTB_UNKNOWN) {
+    *proof = (score > 0) ? 0 : INFTY64;
+    *disproof = (score < 0) ? 0 : INFTY64;
+    return true;
+  }
+
+  Move m[MAX_MOVES];
+  if (!getAllMoves(b, m, FORWARD)) {
+    // international rules: can win or draw, but never lose
+    int indexMe = (b->side == WHITE) ? BB_WALL : BB_BALL;
+    int indexOther = BB_WALL + BB_BALL - indexMe;
+    *proof = (popCount(b->bb[indexMe]) < popCount(b->bb[indexOther])) ? 0 : INFTY64;
+    *disproof = INFTY64;
+    return true;
+  }
+  return false;
+}
+
+u64 Dfpn::probe(Board *b, Move m, u64 key, u64 *proof, u64 *disproof) {
+  if (path.count(key)) {
+    *proof = *disproof = INFTY64; // repetition
+    return key;
+  }
+
+  DfpnEntry *e = find(key);
+  if (e) {
+    *proof = e->proof;
+    *disproof = e->disproof;
+    return e->dependency;
+  }
+
+  // New or replaced position
+  Board c = *b;
+  makeMove(&c, m);
+  numNodes++;
+  *proof = *disproof = 1;
+  evaluate(&c, proof, disproof);
+  store(key, *proof, *disproof, 0, 0);
+  return 0;
+}
+
+void Dfpn::mid(Board *b, u64 z, u64 thProof, u64 thDisproof, int ply) {
+  Move m[MAX_MOVES];
+  u64 key[MAX_MOVES];
+  int nc = getAllMoves(b, m, FORWARD);
+  assert(nc); // positions without moves are scored by evaluate()
+  for (int i = 0; i < nc; i++) {
+    key[i] = updateZobrist(z, b, m[i]);
+  }
+  int start = numNodes;
+  numExpansions++;
+  path[z] = ply;
+
+  u64 p, d, dep;
+  while (true) {
+    // Our proof number is the least disproof number among our children. Also
+    // note the runner-up and, in case we cannot win, the child with the least
+    // proof number that is not already proven.
+    int best = -1, bestDisproving = -1;
+    u64 bestProof = 0, second = INFTY64, minProof = INFTY64;
+    p = INFTY64;
+    d = 0;
+    dep = 0;
+    int depPly = ply;
+    for (int i = 0; i < nc; i++) {
+      u64 cp, cd;
+      u64 cdep = probe(b, m[i], key[i], &cp, &cd);
+      if (cdep && (path[cdep] < depPly)) {
+        dep = cdep;
+        depPly = path[cdep];
+      }
+      if (cd < p) {
+        second = p;
+        p = cd;
+        best = i;
+        bestProof = cp;
+      } else if (cd < second) {
+        second = cd;
+      }
+      if (cp && (cp < minProof)) {
+        minProof = cp;
+        bestDisproving = i;
+      }
+      d = MIN(d + cp, INFTY64);
+      if (!ply) {
+        rootMove[i] = m[i];
+        rootChildProof[i] = cp;
+        rootChildDisproof[i] = cd;
+      }
+    }
+
+    bool final = !p || !d || ((p == INFTY64) && (d == INFTY64));
+    if (final ||
+        ((thProof < INFTY64) && (p >= thProof)) ||
+        ((thDisproof < INFTY64) && (d >= thDisproof)) ||
+        (numNodes >= maxNodes)) {
+      break;
+    }
+
+    // The child's disproof number stays below our proof threshold and a bit
+    // above the runner-up's. Its proof number may use up our slack in d.
+    int c;
+    u64 thP, thD;
+    if (p < INFTY64) {
+      c = best;
+      thD = (second == INFTY64) ? INFTY64 : (second + second / EPSILON_INV + 1);
+      thD = MIN(thD, thProof);
+      thP = ((thDisproof == INFTY64) || (d == INFTY64) || (bestProof == INFTY64))
+        ? INFTY64
+        : (thDisproof - d + bestProof);
+    } else {
+      // We cannot win, so only work on disproving ourselves.
+      c = bestDisproving;
+      thD = INFTY64;
+      thP = (thDisproof == INFTY64) ? INFTY64 : (thDisproof - d + minProof);
+    }
+
+    Board bc = *b;
+    makeMove(&bc, m[c]);
+    mid(&bc, key[c], thP, thD, ply + 1);
+  }
+
+  path.erase(z);
+  store(z, p, d, numNodes - start, dep);
+  if (!ply) {
+    rootProof = p;
+    rootDisproof = d;
+    numRootMoves = nc;
+  }
+}
+
+void Dfpn::search(Board *b) {
+  if (!++generation) {
+    // Wrapped around. Forget everything rather than revive ancient entries.
+    memset(table, 0, (mask + 1) * BUCKET_SIZE * sizeof(DfpnEntry));
+    generation = 1;
+  }
+  numNodes = numExpansions = numRootMoves = 0;
+  path.clear();
+
+  if (!evaluate(b, &rootProof, &rootDisproof)) {
+    mid(b, getZobrist(b), INFTY64, INFTY64, 0);
+  }
+  log(LOG_INFO, "df-pn complete, score %s/%s, %d nodes, %d expansions",
+      dfpnNumber(rootProof).c_str(), dfpnNumber(rootDisproof).c_str(),
+      numNodes, numExpansions);
+}
+
+u64 Dfpn::getProof() {
+  return rootProof;
+}
+
+u64 Dfpn::getDisproof() {
+  return rootDisproof;
+}
+
+int Dfpn::getChildren(Move *m, u64 *proof, u64 *disproof) {
+  for (int i = 0; i < numRootMoves; i++) {
+    m[i] = rootMove[i];
+    proof[i] = rootChildProof[i];
+    disproof[i] = rootChildDisproof[i];
+  }
+  return numRootMoves;
+}
+
+Pn1Searcher* Dfpn::newWorker() {
+  return new Dfpn(maxNodes, sizeMb);
+}
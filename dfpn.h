@@ -0,0 +1,125 @@
+#ifndef __DFPN_H__
+#define __DFPN_H__
+#include <unordered_map>
+#include "pn1_searcher.h"
+#include "pns.h"
+
+/**
+ * An entry in the df-pn transposition table. Packed to 32 bytes.
+ */
+#pragma pack(push, 4)
+typedef struct {
+  u64 key;            // zobrist key of the position, 0 for empty entries
+  u64 dependency;     // shallowest ancestor repeated below the position, or 0
+  PnNumber proof;
+  PnNumber disproof;
+  u32 work;           // positions evaluated under this entry; a measure of its value
+  byte generation;    // search that stored the entry
+} DfpnEntry;
+#pragma pack(pop)
+
+/**
+ * Depth-first proof-number search (Nagai, 2002) with the 1+ε trick (Pawlewicz
+ * and Lew, 2007). Instead of keeping a tree, df-pn keeps (dis)proof numbers in
+ * a transposition table of fixed size and searches each node until its
+ * numbers cross thresholds derived from its parent's. It can therefore run
+ * much longer searches than a Pns tree of the same memory.
+ *
+ * Like in Pns, repetitions count as draws. Numbers derived from them depend
+ * on the path, so each entry remembers the shallowest ancestor that it
+ * repeats and is ignored when that ancestor is not on the current path.
+ * Unsolved entries only live for one search. Proven wins and losses carry over
+ * to later searches until they are replaced.
+ */
+class Dfpn : public Pn1Searcher {
+  /* Entries per bucket. A key is stored in any entry of its bucket. */
+  static const int BUCKET_SIZE = 4;
+
+  /**
+   * Child disproof thresholds are relaxed to (1 + 1/EPSILON_INV) times the
+   * second best child's, so that we don't switch back and forth between two
+   * children with similar numbers.
+   */
+  static const int EPSILON_INV = 4;
+
+  DfpnEntry *table;
+  u64 mask;           // number of buckets - 1
+  int sizeMb;
+  byte generation;
+
+  /**
+   * Maximum number of positions evaluated per search and the number evaluated
+   * so far. Positions are evaluated again if their entries are replaced.
+   */
+  int maxNodes, numNodes;
+  int numExpansions;
+
+  /* Maps the positions on the current search path to their plies. */
+  unordered_map<u64, int> path;
+
+  /* Results of the last search: the root and its children. */
+  u64 rootProof, rootDisproof;
+  int numRootMoves;
+  Move rootMove[MAX_MOVES];
+  u64 rootChildProof[MAX_MOVES], rootChildDisproof[MAX_MOVES];
+
+  /* Returns true iff e belongs to this search or holds a win or a loss. */
+  bool isLive(DfpnEntry *e);
+
+  /**
+   * Returns the entry for key, or NULL if it is missing, stale or depends on
+   * a position that is not on the current path.
+   */
+  DfpnEntry* find(u64 key);
+
+  /**
+   * Stores the numbers for key, overwriting its entry, an empty or stale entry
+   * or the entry with the least work in its bucket, in that order.
+   */
+  void store(u64 key, u64 proof, u64 disproof, u32 work, u64 dependency);
+
+  /**
+   * Scores b through the EGTB or, if it has no legal moves, through the rules.
+   * @return False if b cannot be scored without searching it.
+   */
+  bool evaluate(Board *b, u64 *proof, u64 *disproof);
+
+  /**
+   * Fetches the numbers of the position that move m leads to from b. Children
+   * on the current path are repetitions and count as drawn. Children missing
+   * from the table are evaluated and stored.
+   * @param key Zobrist key of the child.
+   * @return The position on the current path that the numbers depend on, or 0.
+   */
+  u64 probe(Board *b, Move m, u64 key, u64 *proof, u64 *disproof);
+
+  /**
+   * Searches b until its (dis)proof numbers reach their thresholds, the node
+   * is solved or drawn, or we run out of nodes. An INFTY64 threshold
+   * never stops the search. Stores the node's numbers in the table.
+   * @param z Zobrist key of b.
+   * @param ply Distance from the root. At ply 0, saves the root's results.
+   */
+  void mid(Board *b, u64 z, u64 thProof, u64 thDisproof, int ply);
+
+public:
+
+  /**
+   * Creates a df-pn searcher.
+   * @param maxNodes Maximum number of positions to evaluate per search.
+   * @param sizeMb Size of the transposition table, in MB.
+   */
+  Dfpn(int maxNodes, int sizeMb);
+  ~Dfpn();
+
+  void search(Board *b);
+  u64 getProof();
+  u64 getDisproof();
+  int getChildren(Move *m, u64 *proof, u64 *disproof);
+
+  /* Creates a searcher of the same size with its own transposition table. */
+  Pn1Searcher* newWorker();
+
+};
+
+#endif
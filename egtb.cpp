@@ -1,15 +1,23 @@
+#include <algorithm>
 #include <assert.h>
+#include <map>
+#include <pthread.h>
+#include <set>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <vector>
 #include "board.h"
 #include "configfile.h"
 #include "defines.h"
 #include "egtb.h"
 #include "egtb_hash.h"
 #include "egtb_queue.h"
+#include "egtb_stream.h"
 #include "fileutil.h"
+#include "huffman.h"
 #include "logging.h"
 #include "lrucache.h"
 #include "movegen.h"
@@ -18,6 +26,38 @@
 
 LruCache egtbCache;
 
+/**
+ * Guards the EGTB cache, the heat counts and additions to egtbInfo, since PN1
+ * searches and the query server may probe from several threads. Preloaded,
+ * mapped and pinned data is read without it, and chunks are decompressed
+ * outside it. See readFromCache().
+ */
+pthread_mutex_t egtbMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per-table information, gathered on first use. */
+typedef struct {
+  char *preloaded; // entire table held in memory, or NULL; see preloadEgtbs()
+  char *mapped;    // mapping of the .egt file, or NULL; see getMappedEgtb()
+  bool mapTried;   // whether we attempted to map the .egt file
+  HuffmanTable *huffman; // mapping of the .egh file, or NULL
+  int chunkSize;   // block size of the .egh or .idx file, or EGTB_CHUNK_SIZE
+} EgtbInfo;
+
+/* Keyed by egtbGetKey(combo, 0). See getEgtbInfo(). */
+unordered_map<u64, EgtbInfo> egtbInfo;
+
+/**
+ * Probe counts per chunk, keyed by egtbGetKey(combo, chunkNo). Only collected
+ * when cfgEgtbHeatFile is set. See saveEgtbHeat().
+ */
+unordered_map<u64, u64> egtbHeat;
+
+/**
+ * The hottest chunks from the previous run's heat file, decompressed at
+ * startup and never evicted. Keyed by egtbGetKey(combo, chunkNo).
+ */
+unordered_map<u64, char*> egtbHotChunks;
+
 /**
  * Data for the table currently being built. The possible combined values are
  * memOpen[i] = 0, memScore[i] < 0: position evaluated to a loss
@@ -33,8 +73,30 @@ EgtbQueue* retro; // positions left to consider in BFS retrograde analysis
 Board scanB; // construct positions here during scan()
 EgtbHash egtbHash; // to prevent duplicates in child or parent lists
 
+int getComboSize(const char *combo);
+char* getMappedEgtb(const char *combo, bool pinned);
+void loadEgtbHeat();
+
 void initEgtb() {
   egtbCache = lruCacheCreate(cfgEgtbChunks);
+
+  if (cfgEgtbMmap) {
+    char buf[cfgEgtbPinned.size() + 1];
+    strcpy(buf, cfgEgtbPinned.c_str());
+    int count = 0;
+    u64 total = 0;
+    for (char *combo = strtok(buf, " "); combo; combo = strtok(NULL, " ")) {
+      if (getMappedEgtb(combo, true)) {
+        count++;
+        total += getComboSize(combo);
+      }
+    }
+    log(LOG_INFO, "Pinned %d EGTB tables, %llu MB", count, total >> 20);
+  }
+
+  if (!cfgEgtbHeatFile.empty()) {
+    loadEgtbHeat();
+  }
 }
 
 /**
@@ -60,7 +122,82 @@ inline u64 egtbGetKey(const char *combo, unsigned index) {
   return (result << 30) + index;
 }
 
+/* Inverse of egtbGetKey(). */
+string egtbKeyToCombo(u64 key, unsigned *index) {
+  *index = key & ((1 << 30) - 1);
+  string result;
+  for (key >>= 30; key; key >>= 3) {
+    result = (key & 7) ? PIECE_INITIALS[key & 7] + result : 'v' + result;
+  }
+  return result;
+}
+
+/**
+ * Returns the information on combo's table, loading it on first use. Not
+ * thread-safe; see getEgtbInfo().
+ */
+EgtbInfo* loadEgtbInfo(const char *combo) {
+  u64 key = egtbGetKey(combo, 0);
+  auto it = egtbInfo.find(key);
+  if (it != egtbInfo.end()) {
+    return &it->second;
+  }
+
+  EgtbInfo *info = &egtbInfo[key];
+  *info = { NULL, NULL, false, NULL, EGTB_CHUNK_SIZE };
+
+  // Prefer the Huffman-coded table, which is the fastest to decode
+  string eghFile = getHuffmanFileNameForCombo(combo);
+  if (fileExists(eghFile.c_str())) {
+    char *data = mapFile(eghFile.c_str(), getFileSize(eghFile.c_str()), false);
+    if (data) {
+      info->huffman = new HuffmanTable(data);
+      info->chunkSize = info->huffman->getBlockSize();
+      return info;
+    }
+  }
+
+  string idxFile = getIndexFileNameForCombo(combo);
+  int chunkSize = getBlockSize(idxFile.c_str());
+  if (chunkSize) {
+    info->chunkSize = chunkSize;
+  }
+  return info;
+}
+
+/**
+ * Thread-safe version of loadEgtbInfo(). Also maps the uncompressed table on
+ * first use if cfgEgtbMmap is set, so that the information never changes
+ * afterwards and can be read without locking.
+ */
+EgtbInfo* getEgtbInfo(const char *combo) {
+  // Each thread remembers the tables it has seen; only first uses lock.
+  static thread_local unordered_map<u64, EgtbInfo*> seen;
+  u64 key = egtbGetKey(combo, 0);
+  auto it = seen.find(key);
+  if (it != seen.end()) {
+    return it->second;
+  }
+
+  pthread_mutex_lock(&egtbMutex);
+  EgtbInfo *info = loadEgtbInfo(combo);
+  if (cfgEgtbMmap) {
+    getMappedEgtb(combo, false);
+  }
+  pthread_mutex_unlock(&egtbMutex);
+  seen[key] = info;
+  return info;
+}
+
 char* readEgtbChunkFromFile(const char *combo, int chunkNo) {
+  // Look up the Huffman-coded file
+  EgtbInfo *info = getEgtbInfo(combo);
+  if (info->huffman) {
+    char *data = (char*)malloc(info->chunkSize);
+    info->huffman->decodeBlock(chunkNo, data);
+    return data;
+  }
+
   // Look up the compressed file and index
   string compressedFile = getCompressedFileNameForCombo(combo).c_str();
   string idxFile = getIndexFileNameForCombo(combo).c_str();
@@ -73,10 +210,11 @@ char* readEgtbChunkFromFile(const char *combo, int chunkNo) {
   string fileName = getFileNameForCombo(combo).c_str();
   FILE *f = fopen(fileName.c_str(), "r");
   if (f) {
-    int startPos = chunkNo * EGTB_CHUNK_SIZE;
-    assert(data = (char*)malloc(EGTB_CHUNK_SIZE));
+    int chunkSize = info->chunkSize;
+    int startPos = chunkNo * chunkSize;
+    assert(data = (char*)malloc(chunkSize));
     fseek(f, startPos, SEEK_SET);
-    if (!fread(data, 1, EGTB_CHUNK_SIZE, f)) {
+    if (!fread(data, 1, chunkSize, f)) {
       log(LOG_WARNING, "No bytes read from EGTB combo %s chunk %d", combo, chunkNo);
       free(data);
       return NULL;
@@ -90,15 +228,167 @@ char* readEgtbChunkFromFile(const char *combo, int chunkNo) {
   return NULL;
 }
 
+/**
+ * Returns the mapping of combo's uncompressed table, mapping it on first use.
+ * Pinned tables are prefaulted.
+ * @return The mapped table, or NULL if there is no uncompressed table.
+ */
+char* getMappedEgtb(const char *combo, bool pinned) {
+  EgtbInfo *info = loadEgtbInfo(combo);
+  if (!info->mapTried) {
+    string fileName = getFileNameForCombo(combo);
+    info->mapped = mapFile(fileName.c_str(), getComboSize(combo), pinned);
+    info->mapTried = true;
+  }
+  return info->mapped;
+}
+
 int readFromCache(const char *combo, unsigned index) {
-  int chunkNo = index / EGTB_CHUNK_SIZE, chunkOffset = index % EGTB_CHUNK_SIZE;
+  EgtbInfo *info = getEgtbInfo(combo);
+  if (info->preloaded) {
+    return info->preloaded[index];
+  }
+  if (info->mapped) {
+    return info->mapped[index];
+  }
+
+  int chunkNo = index / info->chunkSize, chunkOffset = index % info->chunkSize;
   u64 key = egtbGetKey(combo, chunkNo);
+  bool countHeat = !cfgEgtbHeatFile.empty();
+  if (!egtbHotChunks.empty()) {
+    // written once at startup, so no locking needed
+    auto it = egtbHotChunks.find(key);
+    if (it != egtbHotChunks.end()) {
+      if (countHeat) {
+        pthread_mutex_lock(&egtbMutex);
+        egtbHeat[key]++;
+        pthread_mutex_unlock(&egtbMutex);
+      }
+      return it->second[chunkOffset];
+    }
+  }
+
+  // Read the score while we hold the lock, so that nobody evicts the chunk.
+  pthread_mutex_lock(&egtbMutex);
+  if (countHeat) {
+    egtbHeat[key]++;
+  }
   char *data = (char*)lruCacheGet(&egtbCache, key);
+  int score = data ? data[chunkOffset] : INFTY;
+  pthread_mutex_unlock(&egtbMutex);
+  if (data) {
+    return score;
+  }
+
+  // Decompress outside the lock, so that other threads can probe meanwhile.
+  // Another thread may be decompressing the same chunk; the later copy is
+  // discarded.
+  data = readEgtbChunkFromFile(combo, chunkNo);
   if (!data) {
-    data = readEgtbChunkFromFile(combo, chunkNo);
+    return INFTY;
+  }
+  score = data[chunkOffset];
+  pthread_mutex_lock(&egtbMutex);
+  if (lruCacheContains(&egtbCache, key)) {
+    free(data);
+  } else {
     lruCachePut(&egtbCache, key, data);
   }
-  return data ? data[chunkOffset] : INFTY;
+  pthread_mutex_unlock(&egtbMutex);
+  return score;
+}
+
+/* Returns the (count, key) pairs of egtbHeat, hottest first. */
+vector<pair<u64, u64>> sortEgtbHeat() {
+  vector<pair<u64, u64>> v;
+  for (auto it: egtbHeat) {
+    v.push_back({ it.second, it.first });
+  }
+  sort(v.rbegin(), v.rend());
+  return v;
+}
+
+/**
+ * Loads the previous run's probe counts, then decompresses and pins the
+ * cfgEgtbPinChunks hottest chunks. Counts recorded under a different block
+ * size (because the table was reblocked since) are dropped, as are lines in
+ * the old format, which did not record the block size.
+ */
+void loadEgtbHeat() {
+  FILE *f = fopen(cfgEgtbHeatFile.c_str(), "r");
+  if (!f) {
+    return;
+  }
+  char line[100], combo[EGTB_MEN + 2];
+  int chunkSize;
+  unsigned chunkNo;
+  u64 count;
+  int stale = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if ((sscanf(line, "%6s %d %u %llu", combo, &chunkSize, &chunkNo, &count) == 4) &&
+        (chunkSize == getEgtbInfo(combo)->chunkSize)) {
+      egtbHeat[egtbGetKey(combo, chunkNo)] += count;
+    } else {
+      stale++;
+    }
+  }
+  fclose(f);
+  if (stale) {
+    log(LOG_WARNING, "Dropped %d stale lines from EGTB heat file %s",
+        stale, cfgEgtbHeatFile.c_str());
+  }
+
+  vector<pair<u64, u64>> v = sortEgtbHeat();
+  int n = min((int)v.size(), cfgEgtbPinChunks);
+  for (int i = 0; i < n; i++) {
+    string c = egtbKeyToCombo(v[i].second, &chunkNo);
+    char *data = readEgtbChunkFromFile(c.c_str(), chunkNo);
+    if (data) {
+      egtbHotChunks[v[i].second] = data;
+    }
+  }
+  log(LOG_INFO, "Loaded heat for %d EGTB chunks, pinned %d chunks",
+      (int)v.size(), (int)egtbHotChunks.size());
+}
+
+void saveEgtbHeat() {
+  if (cfgEgtbHeatFile.empty()) {
+    return;
+  }
+
+  pthread_mutex_lock(&egtbMutex); // the query server may be probing
+  vector<pair<u64, u64>> v = sortEgtbHeat();
+  pthread_mutex_unlock(&egtbMutex);
+  FILE *f = fopen(cfgEgtbHeatFile.c_str(), "w");
+  if (!f) {
+    log(LOG_WARNING, "Cannot write EGTB heat file %s", cfgEgtbHeatFile.c_str());
+    return;
+  }
+  map<string, pair<u64, int>> perCombo; // total probes and chunks touched
+  u64 total = 0;
+  for (auto p: v) {
+    unsigned chunkNo;
+    string combo = egtbKeyToCombo(p.second, &chunkNo);
+    fprintf(f, "%s %d %u %llu\n", combo.c_str(), getEgtbInfo(combo.c_str())->chunkSize,
+            chunkNo, p.first);
+    perCombo[combo].first += p.first;
+    perCombo[combo].second++;
+    total += p.first;
+  }
+  fclose(f);
+
+  vector<pair<u64, string>> combos;
+  for (auto it: perCombo) {
+    combos.push_back({ it.second.first, it.first });
+  }
+  sort(combos.rbegin(), combos.rend());
+  log(LOG_INFO, "EGTB heat: %llu probes in %d chunks of %d tables",
+      total, (int)v.size(), (int)combos.size());
+  for (unsigned i = 0; i < combos.size() && i < 20; i++) {
+    log(LOG_INFO, "  %-6s %12llu probes (%5.2f%%) in %d chunks",
+        combos[i].second.c_str(), combos[i].first,
+        100.0 * combos[i].first / total, perCombo[combos[i].second].second);
+  }
 }
 
 void comboToPieceCounts(const char *combo, int counts[2][KING + 1]) {
@@ -208,6 +498,160 @@ int getComboSize(const char *combo) {
   return getEgtbSize(ps, nps) + getEpEgtbSize(ps, nps);
 }
 
+/**
+ * Returns the name of the table holding the given piece counts, switching
+ * sides the way changeSidesIfNeeded() does. Returns an empty string if
+ * either side has no pieces.
+ */
+string pieceCountsToCombo(int c[2][KING + 1]) {
+  int total[2] = { 0, 0 };
+  for (int i = 0; i <= 1; i++) {
+    for (int j = PAWN; j <= KING; j++) {
+      total[i] += c[i][j];
+    }
+  }
+  if (!total[0] || !total[1]) {
+    return "";
+  }
+
+  int w = 0;
+  if (total[0] < total[1]) {
+    w = 1;
+  } else if (total[0] == total[1]) {
+    int p = KING;
+    while ((p > PAWN) && (c[0][p] == c[1][p])) {
+      p--;
+    }
+    w = (c[0][p] < c[1][p]);
+  }
+
+  string result = "";
+  for (int p = KING; p >= PAWN; p--) {
+    result += string(c[w][p], PIECE_INITIALS[p]);
+  }
+  result += 'v';
+  for (int p = KING; p >= PAWN; p--) {
+    result += string(c[1 - w][p], PIECE_INITIALS[p]);
+  }
+  return result;
+}
+
+/**
+ * Collects the names of the tables reachable from combo through one capture,
+ * one promotion or a capture-promotion, by either side.
+ */
+void getConversionCombos(const char *combo, set<string>* result) {
+  int c[2][KING + 1];
+  comboToPieceCounts(combo, c);
+
+  for (int side = 0; side <= 1; side++) {
+    int other = 1 - side;
+    for (int victim = PAWN; victim <= KING; victim++) {
+      if (c[other][victim]) {
+        c[other][victim]--;
+        result->insert(pieceCountsToCombo(c));
+        if (c[side][PAWN]) {
+          for (int promo = KNIGHT; promo <= KING; promo++) {
+            c[side][PAWN]--;
+            c[side][promo]++;
+            result->insert(pieceCountsToCombo(c));
+            c[side][PAWN]++;
+            c[side][promo]--;
+          }
+        }
+        c[other][victim]++;
+      }
+    }
+    if (c[side][PAWN]) {
+      for (int promo = KNIGHT; promo <= KING; promo++) {
+        c[side][PAWN]--;
+        c[side][promo]++;
+        result->insert(pieceCountsToCombo(c));
+        c[side][PAWN]++;
+        c[side][promo]--;
+      }
+    }
+  }
+  result->erase(""); // won or lost outright, no table needed
+}
+
+/**
+ * Reads an entire table from whichever file is available.
+ * @return A malloc'ed copy of the table, or NULL if the table is missing.
+ */
+char* loadEgtb(const char *combo) {
+  int size = getComboSize(combo);
+  char *data = (char*)malloc(size);
+  assert(data);
+
+  EgtbInfo *info = getEgtbInfo(combo);
+  if (info->huffman) {
+    int blockSize = info->chunkSize;
+    for (int i = 0; i * blockSize < size; i++) {
+      info->huffman->decodeBlock(i, data + i * blockSize);
+    }
+    return data;
+  }
+
+  string compressedFile = getCompressedFileNameForCombo(combo);
+  string fileName = getFileNameForCombo(combo);
+  bool ok = decompressFile(compressedFile.c_str(), data, size);
+  if (!ok) {
+    FILE *f = fopen(fileName.c_str(), "r");
+    if (f) {
+      ok = (fread(data, 1, size, f) == (unsigned)size);
+      fclose(f);
+    }
+  }
+
+  if (!ok) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+/**
+ * Loads an entire table into memory.
+ * @return The table size, or 0 if the table is missing.
+ */
+int preloadEgtb(const char *combo) {
+  char *data = loadEgtb(combo);
+  if (!data) {
+    log(LOG_WARNING, "Cannot preload EGTB combo %s", combo);
+    return 0;
+  }
+  getEgtbInfo(combo)->preloaded = data;
+  return getComboSize(combo);
+}
+
+/**
+ * Preloads the given tables in order, as long as they fit in cfgEgtbPreload
+ * megabytes. Tables that don't fit are probed through egtbCache as usual.
+ */
+void preloadEgtbs(set<string>* combos) {
+  u64 budget = (u64)cfgEgtbPreload << 20, total = 0;
+  int count = 0;
+  for (string combo: *combos) {
+    u64 size = getComboSize(combo.c_str());
+    if (total + size <= budget) {
+      size = preloadEgtb(combo.c_str());
+      total += size;
+      count += (size > 0);
+    }
+  }
+  log(LOG_INFO, "Preloaded %d of %d tables, %llu MB",
+      count, (int)combos->size(), total >> 20);
+}
+
+/* Frees all the preloaded tables. */
+void unloadEgtbs() {
+  for (auto& it: egtbInfo) {
+    free(it.second.preloaded);
+    it.second.preloaded = NULL;
+  }
+}
+
 unsigned getEpEgtbIndex(PieceSet *ps, int nps, Board *b) {
   int epSq = ctz(b->bb[BB_EP]);
   int file = epSq & 7;
@@ -631,6 +1075,11 @@ bool generateEgtb(const char *combo) {
   // Collect and enqueue all the immediate stalemates and conversions.
   int size = getEgtbSize(ps, numPieceSets) + getEpEgtbSize(ps, numPieceSets);
   log(LOG_INFO, "Table size: %d", size);
+  if (cfgEgtbPreload) {
+    set<string> combos;
+    getConversionCombos(combo, &combos);
+    preloadEgtbs(&combos);
+  }
   assert(memScore = (char*)malloc(size));
   assert(memOpen = (byte*)malloc(size));
   assert(retro = new EgtbQueue(size));
@@ -670,6 +1119,7 @@ bool generateEgtb(const char *combo) {
   free(memScore);
   free(memOpen);
   delete retro;
+  unloadEgtbs();
   u64 delta = timer.get();
   log(LOG_INFO, "Generation time: %.3f s (%.3f positions/s)", delta / 1000.0, size / (delta / 1000.0));
   logCacheStats(LOG_INFO, &egtbCache, "EGTB");
@@ -712,6 +1162,44 @@ int egtbLookup(Board *b) {
   return egtbLookupWithInfo(b, combo, ps, nps);
 }
 
+int egtbLookupExtended(Board *b, int depth) {
+  int numPieces = popCount(b->bb[BB_WALL] | b->bb[BB_BALL]);
+  if (numPieces <= EGTB_MEN) {
+    return egtbLookup(b);
+  }
+  if (numPieces > EGTB_MEN + depth) {
+    return EGTB_UNKNOWN; // not enough captures left to reach the tables
+  }
+
+  Move m[MAX_MOVES];
+  int numMoves = getAllMoves(b, m, FORWARD);
+  if (!numMoves) {
+    return evalStalemate(b);
+  }
+  if (!isCapture(b, m[0])) {
+    return EGTB_UNKNOWN; // not a forced line
+  }
+
+  // Captures convert, so as in the tables the score is 2, 0 or -2.
+  bool unknown = false, anyDraws = false;
+  for (int i = 0; i < numMoves; i++) {
+    Board b2 = *b;
+    makeMove(&b2, m[i]);
+    int score = egtbLookupExtended(&b2, depth - 1);
+    if (score == EGTB_UNKNOWN || score == INFTY) {
+      unknown = true;
+    } else if (score < 0) {
+      return 2;
+    } else if (!score) {
+      anyDraws = true;
+    }
+  }
+  if (unknown) {
+    return EGTB_UNKNOWN;
+  }
+  return anyDraws ? 0 : -2;
+}
+
 int egtbLookupWithInfo(Board *b, const char *combo, PieceSet *ps, int nps) {
   canonicalizeBoard(ps, nps, b, false);
   unsigned index = getEgtbIndex(ps, nps, b);
@@ -720,7 +1208,7 @@ int egtbLookupWithInfo(Board *b, const char *combo, PieceSet *ps, int nps) {
 
 int batchEgtbLookup(Board *b, string *moveNames, string *fens, int *scores, int *numMoves) {
   Board bcopy = *b;
-  int result = egtbLookup(&bcopy);
+  int result = egtbLookupExtended(&bcopy, cfgEgtbCaptureDepth);
   assert(result != EGTB_UNKNOWN);
 
   Move m[MAX_MOVES];
@@ -730,7 +1218,7 @@ int batchEgtbLookup(Board *b, string *moveNames, string *fens, int *scores, int
     Board b2 = *b;
     makeMove(&b2, m[i]);
     fens[i] = boardToFen(&b2);
-    scores[i] = egtbLookup(&b2);
+    scores[i] = egtbLookupExtended(&b2, cfgEgtbCaptureDepth);
   }
   return result;
 }
@@ -936,7 +1424,15 @@ void verifyEgtb(const char *combo) {
   PieceSet ps[EGTB_MEN];
   int nps = comboToPieceSets(combo, ps);
   int size = getComboSize(combo);
+  if (cfgEgtbPreload) {
+    // Verification probes the table itself as well as its conversions.
+    set<string> combos;
+    combos.insert(combo);
+    getConversionCombos(combo, &combos);
+    preloadEgtbs(&combos);
+  }
   egtbVerifyHelper(combo, WHITE, 0, strlen(combo), 0, &b, m, ps, nps);
+  unloadEgtbs();
   u64 delta = timer.get();
   log(LOG_INFO, "Verification time: %.3f s (%.3f positions/s)", delta / 1000.0, size / (delta / 1000.0));
 }
@@ -973,6 +1469,185 @@ void compressEgtb(const char *combo) {
   log(LOG_INFO, "Compression time: %.3f s (%.3f positions/s)", delta / 1000.0, size / (delta / 1000.0));
 }
 
+/**
+ * Writes combo's table, uncompressed, to dest.
+ * @return The table size, or 0 if the table is missing or corrupt.
+ */
+int decompressEgtbTo(const char *combo, const char *dest) {
+  EgtbStream stream(combo);
+  if (!stream.isOpen()) {
+    log(LOG_WARNING, "Missing EGTB file for combo %s", combo);
+    return 0;
+  }
+  FILE *f = fopen(dest, "wb");
+  unsigned start, size = 0;
+  const char *data;
+  int n;
+  while ((n = stream.next(&start, &data))) {
+    assert(fwrite(data, 1, n, f) == (unsigned)n);
+    size += n;
+  }
+  fclose(f);
+  if (size != (unsigned)getComboSize(combo)) {
+    log(LOG_WARNING, "Read %u positions from combo %s, expected %d", size, combo, getComboSize(combo));
+    unlink(dest);
+    return 0;
+  }
+  return size;
+}
+
+void reblockEgtb(const char *combo, int blockSize) {
+  string compressedName = getCompressedFileNameForCombo(combo);
+  string idxName = getIndexFileNameForCombo(combo);
+  string tmpName = getFileNameForCombo(combo) + ".tmp";
+  string tmpCompressedName = compressedName + ".tmp";
+  string tmpIdxName = idxName + ".tmp";
+  int oldBlockSize = getBlockSize(idxName.c_str());
+  unsigned oldSize = getFileSize(compressedName.c_str());
+
+  if (!decompressEgtbTo(combo, tmpName.c_str())) {
+    return;
+  }
+  compressFile(tmpName.c_str(), tmpCompressedName.c_str(), tmpIdxName.c_str(), blockSize, true);
+  rename(tmpCompressedName.c_str(), compressedName.c_str());
+  rename(tmpIdxName.c_str(), idxName.c_str());
+
+  // Threads may hold pointers to the entry (see getEgtbInfo()), so update it
+  // in place. The Huffman table, if any, and the mapping are unaffected.
+  pthread_mutex_lock(&egtbMutex);
+  auto it = egtbInfo.find(egtbGetKey(combo, 0));
+  if ((it != egtbInfo.end()) && !it->second.huffman) {
+    it->second.chunkSize = blockSize;
+  }
+  pthread_mutex_unlock(&egtbMutex);
+
+  log(LOG_INFO, "Reblocked %s from %d to %d bytes per block, %u to %u bytes",
+      combo, oldBlockSize, blockSize, oldSize, getFileSize(compressedName.c_str()));
+}
+
+void convertEgtbToHuffman(const char *combo, int blockSize) {
+  Timer timer;
+  char *data = loadEgtb(combo);
+  if (!data) {
+    log(LOG_WARNING, "Missing EGTB file for combo %s", combo);
+    return;
+  }
+  int size = getComboSize(combo);
+  string eghFile = getHuffmanFileNameForCombo(combo);
+  unsigned eghSize = HuffmanTable::write(data, size, blockSize, eghFile.c_str());
+  free(data);
+  log(LOG_INFO, "Wrote %s: %u bytes (%.2f%%) in %d-position blocks, %.3f s",
+      eghFile.c_str(), eghSize, 100.0 * eghSize / size, blockSize, timer.get() / 1000.0);
+}
+
+void benchmarkEgtbBlockSizes(const char *combo) {
+  string tmpName = getFileNameForCombo(combo) + ".tmp";
+  string tmpCompressedName = tmpName + ".xz";
+  string tmpIdxName = tmpName + ".idx";
+  string tmpEghName = tmpName + ".egh";
+  int size = decompressEgtbTo(combo, tmpName.c_str());
+  if (!size) {
+    return;
+  }
+
+  log(LOG_INFO, "Benchmarking block sizes for %s (%d bytes uncompressed)", combo, size);
+  for (int blockSize = 4096; blockSize <= 262144; blockSize <<= 1) {
+    compressFile(tmpName.c_str(), tmpCompressedName.c_str(), tmpIdxName.c_str(), blockSize, false);
+    unsigned compressedSize = getFileSize(tmpCompressedName.c_str());
+    int numBlocks = (size + blockSize - 1) / blockSize;
+
+    Timer timer;
+    int probes = 0;
+    while (timer.get() < EGTB_BENCHMARK_MS) {
+      free(decompressBlock(tmpCompressedName.c_str(), tmpIdxName.c_str(), rand() % numBlocks));
+      probes++;
+    }
+    log(LOG_INFO, "LZMA    %6d bytes per block: %10u bytes (%5.2f%%), %8.2f us per block",
+        blockSize, compressedSize, 100.0 * compressedSize / size,
+        1000.0 * timer.get() / probes);
+  }
+
+  char *data = loadEgtb(combo);
+  char block[65536];
+  for (int blockSize = 256; blockSize <= 65536; blockSize <<= 2) {
+    unsigned compressedSize = HuffmanTable::write(data, size, blockSize, tmpEghName.c_str());
+    char *file = mapFile(tmpEghName.c_str(), compressedSize, true);
+    HuffmanTable ht(file);
+    int numBlocks = (size + blockSize - 1) / blockSize;
+
+    Timer timer;
+    int probes = 0;
+    while (timer.get() < EGTB_BENCHMARK_MS) {
+      ht.decodeBlock(rand() % numBlocks, block);
+      probes++;
+    }
+    log(LOG_INFO, "Huffman %6d bytes per block: %10u bytes (%5.2f%%), %8.2f us per block",
+        blockSize, compressedSize, 100.0 * compressedSize / size,
+        1000.0 * timer.get() / probes);
+    munmap(file, compressedSize);
+  }
+  free(data);
+
+  unlink(tmpName.c_str());
+  unlink(tmpCompressedName.c_str());
+  unlink(tmpIdxName.c_str());
+  unlink(tmpEghName.c_str());
+}
+
+void logEgtbStatistics(const char *combo) {
+  EgtbStream stream(combo);
+  if (!stream.isOpen()) {
+    log(LOG_WARNING, "Missing EGTB file for combo %s", combo);
+    return;
+  }
+
+  Timer timer;
+  u64 hist[256] = { 0 };
+  u64 total = 0;
+  unsigned start;
+  const char *data;
+  int n;
+  while ((n = stream.next(&start, &data))) {
+    for (int i = 0; i < n; i++) {
+      hist[(byte)data[i]]++;
+    }
+    total += n;
+  }
+  u64 delta = timer.get();
+
+  u64 wins = 0, losses = 0;
+  int longestWin = 0, longestLoss = 0;
+  for (int score = -128; score < 128; score++) {
+    u64 count = hist[(byte)score];
+    if (count && score > 0) {
+      wins += count;
+      longestWin = score;
+    } else if (count && score < 0) {
+      losses += count;
+      longestLoss = longestLoss ? longestLoss : score;
+    }
+  }
+  u64 draws = hist[0];
+
+  log(LOG_INFO, "Statistics for %s: %llu positions, read in %.3f s (%.0f positions/s)",
+      combo, total, delta / 1000.0, total / (delta / 1000.0));
+  if (total != (u64)getComboSize(combo)) {
+    log(LOG_WARNING, "Expected %d positions", getComboSize(combo));
+  }
+  if (!total) {
+    return;
+  }
+  log(LOG_INFO, "Wins: %llu (%.2f%%), longest %d", wins, 100.0 * wins / total, longestWin);
+  log(LOG_INFO, "Losses: %llu (%.2f%%), longest %d", losses, 100.0 * losses / total, longestLoss);
+  log(LOG_INFO, "Draws: %llu (%.2f%%)", draws, 100.0 * draws / total);
+  log(LOG_INFO, "Decisive: %llu (%.2f%%)", wins + losses, 100.0 * (wins + losses) / total);
+  for (int score = -128; score < 128; score++) {
+    if (hist[(byte)score]) {
+      log(LOG_INFO, "  score %4d: %12llu", score, hist[(byte)score]);
+    }
+  }
+}
+
 void generateAllEgtb(int wc, int bc) {
   Timer timer;
   for (int i = 0; i < choose[wc + 5][wc]; i++) {
@@ -52,6 +52,16 @@ bool generateEgtb(const char *combo);
 */
 int egtbLookup(Board *b);
 
+/**
+ * Like egtbLookup(), but also scores positions with more than EGTB_MEN pieces
+ * when every line leads into the tables through forced captures. Searches at
+ * most depth plies, all of which must be captures. Since captures convert, a
+ * win or loss scored this way is 2 or -2, like in the tables. Returns
+ * EGTB_UNKNOWN when some line leaves the forced captures or exceeds the depth.
+ * Clobbers b.
+ */
+int egtbLookupExtended(Board *b, int depth);
+
 /* Queries the EGTB for this position. The caller must pass some extra information (this information is identical over large numbers of queries
  * during EGTB generation / verification). Takes care of canonicalization, but assumes the sides are already correct.
  * Returns the score shifted by 1. Returns INFTY on errors (missing EGTB file, more than EGTB_MEN pieces on the board etc.).
@@ -59,7 +69,8 @@ int egtbLookup(Board *b);
 int egtbLookupWithInfo(Board *b, const char *combo, PieceSet *ps, int nps);
 
 /**
- * Takes a board and sets/returns five values:
+ * Takes a board and sets/returns five values, scoring positions with
+ * egtbLookupExtended() (EGTB_UNKNOWN for children outside its reach):
  * - an array of move names listing all the legal moves
  * - an array of FEN-encoded boards listing the corresponding resulting positions
  * - an array of scores for the boards resulting after each of the above moves
@@ -77,6 +88,38 @@ void verifyEgtb(const char *combo);
 /* Compresses the combo.egt file into a combo.egt.xz and combo.idx. Does nothing if the table is already compressed. */
 void compressEgtb(const char *combo);
 
+/**
+ * Rewrites combo's .egt.xz and .idx files using the given block size. Smaller
+ * blocks are faster to decode on a cache miss, but compress worse. Do not call
+ * this while the table is being probed.
+ */
+void reblockEgtb(const char *combo, int blockSize);
+
+/**
+ * Writes combo's table in the Huffman-coded format (.egh), which is much
+ * faster to probe than .egt.xz. When both exist, probes use the .egh file.
+ */
+void convertEgtbToHuffman(const char *combo, int blockSize);
+
+/**
+ * Compresses combo's table with a range of block sizes, both with LZMA and
+ * with Huffman coding, and logs, for each size, the compressed size and the
+ * time it takes to decode a random block. Leaves the existing files untouched.
+ */
+void benchmarkEgtbBlockSizes(const char *combo);
+
+/**
+ * Reads combo's table front to back and logs the number of wins, losses and
+ * draws and a histogram of the scores.
+ */
+void logEgtbStatistics(const char *combo);
+
+/**
+ * Writes the per-chunk probe counts to cfgEgtbHeatFile, hottest first, and
+ * logs the hottest tables. Does nothing if cfgEgtbHeatFile is not set.
+ */
+void saveEgtbHeat();
+
 /* Generates all EGTB where white has wc pieces and black has bc pieces */
 void generateAllEgtb(int wc, int bc);
 
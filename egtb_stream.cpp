@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "egtb_stream.h"
+#include "fileutil.h"
+#include "logging.h"
+
+EgtbStream::EgtbStream(const char *combo) {
+  f = NULL;
+  compressed = false;
+  mapped = NULL;
+  huffman = NULL;
+  in = NULL;
+  pos = nextBlock = 0;
+  done = false;
+  int outSize = OUT_SIZE;
+
+  string fileName = getFileNameForCombo(combo);
+  string eghFile = getHuffmanFileNameForCombo(combo);
+  string compressedFile = getCompressedFileNameForCombo(combo);
+  if ((f = fopen(fileName.c_str(), "rb"))) {
+    // nothing else to set up
+  } else if (fileExists(eghFile.c_str())) {
+    mappedSize = getFileSize(eghFile.c_str());
+    mapped = mapFile(eghFile.c_str(), mappedSize, false);
+    if (mapped) {
+      madvise(mapped, mappedSize, MADV_SEQUENTIAL);
+      huffman = new HuffmanTable(mapped);
+      if (huffman->getBlockSize() > outSize) {
+        outSize = huffman->getBlockSize();
+      }
+    }
+  } else if ((f = fopen(compressedFile.c_str(), "rb"))) {
+    compressed = true;
+    strm = LZMA_STREAM_INIT;
+    assert(lzma_stream_decoder(&strm, UINT64_MAX, 0) == LZMA_OK);
+    action = LZMA_RUN;
+    assert(in = (uint8_t*)malloc(IN_SIZE));
+  }
+
+  if (f) {
+    posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  assert(out = (char*)malloc(outSize));
+}
+
+EgtbStream::~EgtbStream() {
+  if (f) {
+    fclose(f);
+  }
+  if (compressed) {
+    lzma_end(&strm);
+    free(in);
+  }
+  if (huffman) {
+    delete huffman;
+    munmap(mapped, mappedSize);
+  }
+  free(out);
+}
+
+bool EgtbStream::isOpen() {
+  return f || huffman;
+}
+
+int EgtbStream::next(unsigned *start, const char **data) {
+  int n = 0;
+  if (done || !isOpen()) {
+    return 0;
+  }
+
+  if (huffman) {
+    int blockSize = huffman->getBlockSize();
+    while (n + blockSize <= OUT_SIZE || !n) {
+      if ((u64)nextBlock * blockSize >= (u64)huffman->getSize()) {
+        break;
+      }
+      huffman->decodeBlock(nextBlock, out + n);
+      n += min(blockSize, huffman->getSize() - nextBlock * blockSize);
+      nextBlock++;
+    }
+  } else if (!compressed) {
+    n = fread(out, 1, OUT_SIZE, f);
+  } else {
+    strm.next_out = (uint8_t*)out;
+    strm.avail_out = OUT_SIZE;
+    lzma_ret ret = LZMA_OK;
+    while (strm.avail_out && (ret == LZMA_OK)) {
+      if (!strm.avail_in && (action == LZMA_RUN)) {
+        strm.next_in = in;
+        strm.avail_in = fread(in, 1, IN_SIZE, f);
+        if (feof(f)) {
+          action = LZMA_FINISH;
+        }
+      }
+      ret = lzma_code(&strm, action);
+    }
+    if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+      log(LOG_WARNING, "Corrupt compressed table after %u positions", pos);
+    }
+    n = OUT_SIZE - strm.avail_out;
+    done = (ret != LZMA_OK); // the decoder cannot be called again
+  }
+
+  done |= !n;
+  *start = pos;
+  *data = out;
+  pos += n;
+  return n;
+}
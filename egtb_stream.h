@@ -0,0 +1,54 @@
+#ifndef __EGTB_STREAM_H__
+#define __EGTB_STREAM_H__
+#include <lzma.h>
+#include <stdio.h>
+#include "huffman.h"
+
+/**
+ * Class that reads an entire table front to back, for passes over all the
+ * positions such as statistics or conversions. Unlike probing, it does not go
+ * through the EGTB cache. The .egt.xz file is decoded with a single decoder
+ * and read in large sequential pieces, so the pass runs at decompression
+ * speed. Also reads .egt and .egh files, preferring the cheapest to decode.
+ */
+class EgtbStream {
+
+  static const int IN_SIZE = 1 << 20;  // compressed bytes per read
+  static const int OUT_SIZE = 1 << 20; // positions per range
+
+  FILE *f;          // .egt or .egt.xz file
+  bool compressed;  // whether f is an .egt.xz file
+  lzma_stream strm;
+  lzma_action action;
+  uint8_t *in;
+  char *out;
+
+  char *mapped;     // mapping of the .egh file, or NULL
+  unsigned mappedSize;
+  HuffmanTable *huffman;
+  int nextBlock;
+
+  unsigned pos;     // index of the next position to decode
+  bool done;
+
+public:
+
+  EgtbStream(const char *combo);
+  ~EgtbStream();
+
+  /* Returns true iff some table file was found. */
+  bool isOpen();
+
+  /**
+   * Decodes the next range of consecutive positions.
+   * @param start Set to the index of the first position in the range.
+   * @param data Set to the scores of the positions in the range. They remain
+   * valid until the next call.
+   * @return The number of positions in the range, or 0 at the end of the
+   * table.
+   */
+  int next(unsigned *start, const char **data);
+
+};
+
+#endif
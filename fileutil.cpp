@@ -1,6 +1,8 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <lzma.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "bitmanip.h"
@@ -18,6 +20,10 @@ string getCompressedFileNameForCombo(const char *combo) {
   return cfgEgtbPath + "/" + combo + ".egt.xz";
 }
 
+string getHuffmanFileNameForCombo(const char *combo) {
+  return cfgEgtbPath + "/" + combo + ".egh";
+}
+
 string getIndexFileNameForCombo(const char *combo) {
   return cfgEgtbPath + "/" + combo + ".idx";
 }
@@ -32,6 +38,59 @@ unsigned getFileSize(const char *fileName) {
   return st.st_size;
 }
 
+char* mapFile(const char *fileName, unsigned size, bool populate) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  if (st.st_size != size || !size) {
+    log(LOG_WARNING, "File %s has size %lld, expected %u",
+        fileName, (long long)st.st_size, size);
+    close(fd);
+    return NULL;
+  }
+
+  int flags = MAP_SHARED | (populate ? MAP_POPULATE : 0);
+  void *data = mmap(NULL, size, PROT_READ, flags, fd, 0);
+  close(fd); // the mapping stays valid
+  if (data == MAP_FAILED) {
+    log(LOG_WARNING, "Cannot map file %s", fileName);
+    return NULL;
+  }
+  madvise(data, size, populate ? MADV_WILLNEED : MADV_RANDOM);
+  return (char*)data;
+}
+
+char* mapFilePrivate(const char *fileName, u64 *size) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  *size = st.st_size;
+  void *data = *size
+    ? mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+    : MAP_FAILED;
+  close(fd); // the mapping stays valid
+  if (data == MAP_FAILED) {
+    log(LOG_WARNING, "Cannot map file %s", fileName);
+    return NULL;
+  }
+  return (char*)data;
+}
+
+void unmapPages(void *data, u64 size) {
+  u64 pageSize = sysconf(_SC_PAGESIZE);
+  u64 start = ((u64)data + pageSize - 1) / pageSize * pageSize;
+  u64 end = ((u64)data + size) / pageSize * pageSize;
+  if (start < end) {
+    munmap((void*)start, end - start);
+  }
+}
+
 void appendEgtbNote(const char *note, const char *combo) {
   string fileName = string(cfgEgtbPath) + "/notes.txt";
   FILE *f = fopen(fileName.c_str(), "at");
@@ -87,6 +146,8 @@ void compressBlocks(FILE *fin, FILE *fout, FILE *fidx, int blockSize) {
 	filters[1].id = LZMA_VLI_UNKNOWN;
 	assert(lzma_stream_encoder(&strm, filters, LZMA_CHECK_CRC32) == LZMA_OK);
 
+  unsigned header[2] = { EGTB_IDX_MAGIC, (unsigned)blockSize };
+  fwrite(header, sizeof(unsigned), 2, fidx);
   unsigned offset = 0;  // Keep track of current place in fout
   unsigned block0 = 12; // Block 0 starts on byte 12, after the header
   fwrite(&block0, sizeof(unsigned), 1, fidx);
@@ -121,12 +182,12 @@ void compressFile(const char *name, const char *compressed, const char *index, i
 
 /* Decodes a block starting at the current position in fin. Assumes that outSize bytes are sufficient to hold all the data. */
 void decodeBlock(lzma_stream *strm, FILE *fin, char *out, int outSize, int compressedLength) {
-	uint8_t in[EGTB_CHUNK_SIZE];
+	uint8_t in[compressedLength];
 
   strm->next_in = in;
   strm->avail_in = fread(in, 1, compressedLength, fin);
   strm->next_out = (uint8_t*)out;
-  strm->avail_out = EGTB_CHUNK_SIZE;
+  strm->avail_out = outSize;
 
   while (strm->avail_in) {
 		lzma_ret ret = lzma_code(strm, LZMA_RUN);
@@ -134,6 +195,32 @@ void decodeBlock(lzma_stream *strm, FILE *fin, char *out, int outSize, int compr
 	}
 }
 
+/**
+ * Reads the index header, if any, and leaves fidx positioned at the offset of
+ * block 0. Returns the block size.
+ */
+int readIndexHeader(FILE *fidx) {
+  unsigned header[2];
+  if (fread(header, sizeof(unsigned), 2, fidx) != 2) {
+    return 0;
+  }
+  if (header[0] == EGTB_IDX_MAGIC) {
+    return header[1];
+  }
+  fseek(fidx, 0, SEEK_SET);
+  return EGTB_CHUNK_SIZE;
+}
+
+int getBlockSize(const char *index) {
+  FILE *fidx = fopen(index, "rb");
+  if (!fidx) {
+    return 0;
+  }
+  int blockSize = readIndexHeader(fidx);
+  fclose(fidx);
+  return blockSize;
+}
+
 char* decompressBlock(const char *compressed, const char *index, int blockNum) {
   FILE *fin = fopen(compressed, "rb");
   FILE *fidx = fopen(index, "rb");
@@ -142,7 +229,8 @@ char* decompressBlock(const char *compressed, const char *index, int blockNum) {
   }
 
   unsigned offset[2]; // Offset of our block and the next
-  fseek(fidx, sizeof(unsigned) * blockNum, SEEK_SET);
+  int blockSize = readIndexHeader(fidx);
+  fseek(fidx, sizeof(unsigned) * blockNum, SEEK_CUR);
   assert(fread(&offset, sizeof(unsigned), 2, fidx) == 2);
   fclose(fidx);
 
@@ -151,15 +239,46 @@ char* decompressBlock(const char *compressed, const char *index, int blockNum) {
 	assert(lzma_stream_decoder(&strm, UINT64_MAX, 0) == LZMA_OK);
 
   // Read the header, then our sector
-  char *result = (char*)malloc(EGTB_CHUNK_SIZE);
-  decodeBlock(&strm, fin, result, EGTB_CHUNK_SIZE, 12);
+  char *result = (char*)malloc(blockSize);
+  decodeBlock(&strm, fin, result, blockSize, 12);
   fseek(fin, offset[0], SEEK_SET);
-  decodeBlock(&strm, fin, result, EGTB_CHUNK_SIZE, offset[1] - offset[0]);
+  decodeBlock(&strm, fin, result, blockSize, offset[1] - offset[0]);
   fclose(fin);
 	lzma_end(&strm);
   return result;
 }
 
+bool decompressFile(const char *compressed, char *dest, unsigned size) {
+  FILE *fin = fopen(compressed, "rb");
+  if (!fin) {
+    return false;
+  }
+
+  lzma_stream strm = LZMA_STREAM_INIT;
+  assert(lzma_stream_decoder(&strm, UINT64_MAX, 0) == LZMA_OK);
+  uint8_t in[EGTB_CHUNK_SIZE];
+  strm.next_out = (uint8_t*)dest;
+  strm.avail_out = size;
+
+  // Unlike decompressBlock(), decode the stream front to back in one go.
+  lzma_action action = LZMA_RUN;
+  lzma_ret ret = LZMA_OK;
+  while (ret == LZMA_OK) {
+    if (!strm.avail_in && (action == LZMA_RUN)) {
+      strm.next_in = in;
+      strm.avail_in = fread(in, 1, EGTB_CHUNK_SIZE, fin);
+      if (feof(fin)) {
+        action = LZMA_FINISH;
+      }
+    }
+    ret = lzma_code(&strm, action);
+  }
+  fclose(fin);
+  bool complete = (ret == LZMA_STREAM_END) && !strm.avail_out;
+  lzma_end(&strm);
+  return complete;
+}
+
 void writeVlq(u64 x, FILE* f) {
   static byte b[10];
   int size = 0;
@@ -185,3 +304,29 @@ u64 readVlq(FILE* f) {
   } while (b & 128);
   return result;
 }
+
+void writeVlq(u64 x, byte** p) {
+  byte b[10];
+  int size = 0;
+
+  while (x || (size == 0)) {
+    b[size++] = 128 ^ (x & 127); // number continues
+    x >>= 7;
+  }
+
+  b[0] ^= 128; // remove continuation bit from the least significant group
+
+  while (size--) {
+    *(*p)++ = b[size];
+  }
+}
+
+u64 readVlq(byte** p) {
+  u64 result = 0;
+  byte b;
+  do {
+    b = *(*p)++;
+    result = (result << 7) ^ (b & 127);
+  } while (b & 128);
+  return result;
+}
@@ -8,6 +8,9 @@ string getFileNameForCombo(const char *combo);
 /* Returns the file name for a compressed table, e.g. /path/to/RRvNN.egt.xz */
 string getCompressedFileNameForCombo(const char *combo);
 
+/* Returns the file name for a Huffman-coded table, e.g. /path/to/RRvNN.egh */
+string getHuffmanFileNameForCombo(const char *combo);
+
 /* Returns the file name for a compressed table index, e.g. /path/to/RRvNN.idx */
 string getIndexFileNameForCombo(const char *combo);
 
@@ -17,6 +20,30 @@ bool fileExists(const char *fileName);
 /* Returns the size of the specified file, in bytes */
 unsigned getFileSize(const char *fileName);
 
+/**
+ * Maps a file read-only into memory. If populate is set, prefaults the pages
+ * and advises the kernel that we will need them. Otherwise advises random
+ * access.
+ * @param size Expected file size. Files of any other size are not mapped.
+ * @return A pointer to the mapping, or NULL if the file is missing or has the
+ * wrong size.
+ */
+char* mapFile(const char *fileName, unsigned size, bool populate);
+
+/**
+ * Maps an entire file into memory, copy-on-write: the mapping is writable,
+ * but changes never reach the file. Prefaults nothing.
+ * @param size Receives the file size.
+ * @return A pointer to the mapping, or NULL if the file cannot be mapped.
+ */
+char* mapFilePrivate(const char *fileName, u64 *size);
+
+/**
+ * Unmaps the pages that lie entirely within [data, data + size), so that
+ * pages shared with neighboring data stay mapped.
+ */
+void unmapPages(void *data, u64 size);
+
 /* Log a note of interesting events during EGTB generation / probing */
 void appendEgtbNote(const char *note, const char *combo);
 
@@ -30,13 +57,27 @@ void appendEgtbNote(const char *note, const char *combo);
  **/
 void compressFile(const char *name, const char *compressed, const char *index, int blockSize, bool removeOriginal);
 
+/**
+ * Returns the block size recorded in an index file. Index files written before
+ * block sizes were recorded use EGTB_CHUNK_SIZE.
+ * Returns 0 if the index file is missing.
+ **/
+int getBlockSize(const char *index);
+
 /**
  * Returns the blockNum block (0-based) from the compressed file.
- * The block size was fixed at compression and should match EGTB_CHUNK_SIZE.
+ * The block size is read from the index file, see getBlockSize().
  * Returns NULL if the compressed or index files are missing or corrupt.
  **/
 char* decompressBlock(const char *compressed, const char *index, int blockNum);
 
+/**
+ * Decompresses an entire compressed file into dest, which must hold exactly
+ * size bytes. Returns false if the file is missing, corrupt or of the wrong
+ * size.
+ **/
+bool decompressFile(const char *compressed, char *dest, unsigned size);
+
 /**
  * Encodes x to a 7-bit variable-length quantity and writes it to f.
  */
@@ -47,4 +88,16 @@ void writeVlq(u64 x, FILE* f);
  */
 u64 readVlq(FILE* f);
 
+/**
+ * Encodes x to a 7-bit variable-length quantity and stores it at *p, which is
+ * advanced past it. Stores at most 10 bytes.
+ */
+void writeVlq(u64 x, byte** p);
+
+/**
+ * Reads a 7-bit encoded variable-length quantity from *p and advances *p past
+ * it.
+ */
+u64 readVlq(byte** p);
+
 #endif
@@ -0,0 +1,187 @@
+#include <assert.h>
+#include <queue>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "huffman.h"
+
+bool HuffmanCode::buildLengths(u64 *freq) {
+  // Leaves are nodes 0-255, internal nodes are numbered from 256 up.
+  int parent[512];
+  priority_queue<pair<u64, int>, vector<pair<u64, int>>, greater<pair<u64, int>>> pq;
+  for (int s = 0; s < 256; s++) {
+    if (freq[s]) {
+      pq.push({ freq[s], s });
+    }
+  }
+
+  int next = 256;
+  while (pq.size() > 1) {
+    auto a = pq.top();
+    pq.pop();
+    auto b = pq.top();
+    pq.pop();
+    parent[a.second] = parent[b.second] = next;
+    pq.push({ a.first + b.first, next++ });
+  }
+  int root = pq.empty() ? -1 : pq.top().second;
+
+  for (int s = 0; s < 256; s++) {
+    len[s] = 0;
+    if (freq[s]) {
+      int depth = 0;
+      for (int x = s; x != root; x = parent[x]) {
+        depth++;
+      }
+      len[s] = depth ? depth : 1; // a lone symbol still needs one bit
+      if (len[s] > MAX_BITS) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void HuffmanCode::buildCodes() {
+  unsigned next = 0;
+  for (int l = 1; l <= MAX_BITS; l++) {
+    for (int s = 0; s < 256; s++) {
+      if (len[s] == l) {
+        code[s] = next++;
+      }
+    }
+    next <<= 1;
+  }
+
+  memset(decodeTable, 0, sizeof(decodeTable));
+  for (int s = 0; s < 256; s++) {
+    if (len[s]) {
+      int shift = MAX_BITS - len[s];
+      for (unsigned i = 0; i < (1u << shift); i++) {
+        decodeTable[(code[s] << shift) + i] = s | (len[s] << 8);
+      }
+    }
+  }
+}
+
+void HuffmanCode::build(const u64 *freq) {
+  u64 f[256];
+  memcpy(f, freq, sizeof(f));
+  // Flatten the distribution until the longest code fits. This converges
+  // because all nonzero frequencies eventually become 1.
+  while (!buildLengths(f)) {
+    for (int s = 0; s < 256; s++) {
+      f[s] = (f[s] + 1) / 2;
+    }
+  }
+  buildCodes();
+}
+
+void HuffmanCode::setLengths(const byte *lengths) {
+  memcpy(len, lengths, sizeof(len));
+  buildCodes();
+}
+
+const byte* HuffmanCode::getLengths() {
+  return len;
+}
+
+int HuffmanCode::encode(const byte *in, int n, byte *out) {
+  u64 acc = 0;
+  int bits = 0, pos = 0;
+  for (int i = 0; i < n; i++) {
+    assert(len[in[i]]);
+    acc = (acc << len[in[i]]) | code[in[i]];
+    bits += len[in[i]];
+    while (bits >= 8) {
+      bits -= 8;
+      out[pos++] = acc >> bits;
+    }
+  }
+  if (bits) {
+    out[pos++] = acc << (8 - bits);
+  }
+  return pos;
+}
+
+void HuffmanCode::decode(const byte *in, int n, byte *out) {
+  u64 acc = 0;
+  int bits = 0;
+  for (int i = 0; i < n; i++) {
+    if (bits < MAX_BITS) {
+      // Refill 32 bits at a time. Older bits fall off the top of acc.
+      unsigned w;
+      memcpy(&w, in, sizeof(w));
+      acc = (acc << 32) | __builtin_bswap32(w);
+      in += 4;
+      bits += 32;
+    }
+    u16 e = decodeTable[(acc >> (bits - MAX_BITS)) & ((1 << MAX_BITS) - 1)];
+    out[i] = e & 255;
+    bits -= e >> 8;
+  }
+}
+
+HuffmanTable::HuffmanTable(char *file) {
+  header = (EghHeader*)file;
+  assert(header->magic == MAGIC);
+  offsets = (unsigned*)(file + sizeof(EghHeader));
+  data = (byte*)(offsets + header->numBlocks + 1);
+  code.setLengths(header->lengths);
+}
+
+int HuffmanTable::getSize() {
+  return header->size;
+}
+
+int HuffmanTable::getBlockSize() {
+  return header->blockSize;
+}
+
+void HuffmanTable::decodeBlock(int blockNum, char *dest) {
+  assert((unsigned)blockNum < header->numBlocks);
+  int n = header->size - blockNum * header->blockSize;
+  if (n > (int)header->blockSize) {
+    n = header->blockSize;
+  }
+  code.decode(data + offsets[blockNum], n, (byte*)dest);
+}
+
+unsigned HuffmanTable::write(const char *src, unsigned size, int blockSize, const char *dest) {
+  const byte *in = (const byte*)src;
+  u64 freq[256] = { 0 };
+  for (unsigned i = 0; i < size; i++) {
+    freq[in[i]]++;
+  }
+
+  EghHeader h;
+  h.magic = MAGIC;
+  h.size = size;
+  h.blockSize = blockSize;
+  h.numBlocks = (size + blockSize - 1) / blockSize;
+  HuffmanCode code;
+  code.build(freq);
+  memcpy(h.lengths, code.getLengths(), sizeof(h.lengths));
+
+  FILE *f = fopen(dest, "wb");
+  assert(f);
+  fwrite(&h, sizeof(h), 1, f);
+  vector<unsigned> offsets(h.numBlocks + 1, 0);
+  fwrite(&offsets[0], sizeof(unsigned), h.numBlocks + 1, f); // filled in below
+
+  vector<byte> out((blockSize * HuffmanCode::MAX_BITS + 7) / 8);
+  for (unsigned b = 0; b < h.numBlocks; b++) {
+    unsigned start = b * blockSize;
+    int n = (size - start < (unsigned)blockSize) ? (size - start) : blockSize;
+    int len = code.encode(in + start, n, &out[0]);
+    fwrite(&out[0], 1, len, f);
+    offsets[b + 1] = offsets[b] + len;
+  }
+  u64 padding = 0;
+  fwrite(&padding, sizeof(padding), 1, f);
+
+  fseek(f, sizeof(h), SEEK_SET);
+  fwrite(&offsets[0], sizeof(unsigned), h.numBlocks + 1, f);
+  fclose(f);
+  return sizeof(h) + (h.numBlocks + 1) * sizeof(unsigned) + offsets[h.numBlocks] + sizeof(padding);
+}
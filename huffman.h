@@ -0,0 +1,98 @@
+#ifndef __HUFFMAN_H__
+#define __HUFFMAN_H__
+#include "defines.h"
+
+/**
+ * Canonical Huffman coding of byte values, used as a fast alternative to LZMA
+ * for endgame tables. Codes are limited to MAX_BITS bits so that every symbol
+ * can be decoded with a single table lookup.
+ */
+class HuffmanCode {
+
+public:
+  static const int MAX_BITS = 12;
+
+private:
+  byte len[256];  // code length of every symbol, 0 for unused symbols
+  unsigned code[256];
+  u16 decodeTable[1 << MAX_BITS]; // symbol in the low byte, length in the high byte
+
+  /**
+   * Computes Huffman code lengths for the given frequencies.
+   * @return false if some code is longer than MAX_BITS.
+   */
+  bool buildLengths(u64 *freq);
+
+  /* Assigns canonical codes from the code lengths and builds the decode table. */
+  void buildCodes();
+
+public:
+
+  /* Builds a length-limited code for the given symbol frequencies. */
+  void build(const u64 *freq);
+
+  /* Rebuilds the code from code lengths previously returned by getLengths(). */
+  void setLengths(const byte *lengths);
+
+  /* Returns the 256 code lengths, which fully describe a canonical code. */
+  const byte* getLengths();
+
+  /**
+   * Encodes n symbols to out, most significant bit first, padding the last
+   * byte with zeroes. out must hold at least (n * MAX_BITS + 7) / 8 bytes.
+   * @return The number of bytes written.
+   */
+  int encode(const byte *in, int n, byte *out);
+
+  /**
+   * Decodes n symbols from in to out. May read up to 4 bytes past the end of
+   * the encoded data.
+   */
+  void decode(const byte *in, int n, byte *out);
+
+};
+
+/* Header of a Huffman-coded table file (.egh). */
+typedef struct {
+  unsigned magic;
+  unsigned size;      // number of positions
+  unsigned blockSize; // number of positions per block
+  unsigned numBlocks;
+  byte lengths[256];  // see HuffmanCode::getLengths()
+} EghHeader;
+
+/**
+ * Read-only view of a Huffman-coded table file. The file consists of an
+ * EghHeader, numBlocks + 1 offsets of the blocks relative to the start of the
+ * data, the data itself and 8 bytes of padding. Each block is coded
+ * separately, so looking up a position only requires decoding its block.
+ */
+class HuffmanTable {
+
+  EghHeader *header;
+  unsigned *offsets;
+  byte *data;
+  HuffmanCode code;
+
+public:
+
+  static const unsigned MAGIC = 0x31686765; // "egh1"
+
+  /* Wraps the contents of a file, usually mapped in memory. */
+  HuffmanTable(char *file);
+
+  int getSize();
+  int getBlockSize();
+
+  /* Decodes block blockNum to dest, which must hold getBlockSize() bytes. */
+  void decodeBlock(int blockNum, char *dest);
+
+  /**
+   * Codes size bytes of table data and writes them to file dest.
+   * @return The size of the file.
+   */
+  static unsigned write(const char *src, unsigned size, int blockSize, const char *dest);
+
+};
+
+#endif
@@ -2,12 +2,14 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "configfile.h"
 #include "logging.h"
 #include "timer.h"
 
 static const char *LOG_LEVEL_NAMES[] = { "", "ERROR", "WARNING", "INFO", "DEBUG" };
 static FILE *logFile;
+static bool forked = false; // see logForked()
 Timer logTimer;
 
 void logInit(const char *fileName) {
@@ -22,14 +24,31 @@ void logInit(const char *fileName) {
   logTimer.reset();
 }
 
+void logForked() {
+  forked = true;
+}
+
 void vlog(int level, const char *format, va_list vl) {
   if (level <= cfgLogLevel) {
     u64 millis = logTimer.get();
-    fprintf(logFile, "[%7llu.%03llu] [%s] ",
-            millis / 1000, millis % 1000, LOG_LEVEL_NAMES[level]);
-    vfprintf(logFile, format, vl);
-    fprintf(logFile, "\n");
-    fflush(logFile);
+    if (forked) {
+      // Format the line ourselves and write it in one call. See logForked().
+      char buf[1000];
+      int n = snprintf(buf, sizeof(buf), "[%7llu.%03llu] [%s] ",
+                       millis / 1000, millis % 1000, LOG_LEVEL_NAMES[level]);
+      n += vsnprintf(buf + n, sizeof(buf) - n - 1, format, vl);
+      n = MIN(n, (int)sizeof(buf) - 2); // the message may have been cut short
+      buf[n++] = '\n';
+      assert(write(fileno(logFile), buf, n) == n);
+    } else {
+      flockfile(logFile); // keep lines from different threads apart
+      fprintf(logFile, "[%7llu.%03llu] [%s] ",
+              millis / 1000, millis % 1000, LOG_LEVEL_NAMES[level]);
+      vfprintf(logFile, format, vl);
+      fprintf(logFile, "\n");
+      fflush(logFile);
+      funlockfile(logFile);
+    }
   }
 }
 
@@ -45,5 +64,8 @@ void die(const char *format, ...) {
   va_start(vl, format);
   vlog(LOG_ERROR, format, vl);
   va_end(vl);
+  if (forked) {
+    _exit(1);
+  }
   exit(1);
 }
@@ -15,4 +15,12 @@ void log(int level, const char *format, ...);
 /* Logs an error message and terminates the program. */
 void die(const char *format, ...);
 
+/**
+ * Makes logging safe in a child forked from a multithreaded process. Another
+ * thread may have held the log file's lock at the time of the fork. From now
+ * on, messages bypass stdio and go straight to the file with write(2), and
+ * die() calls _exit().
+ */
+void logForked();
+
 #endif
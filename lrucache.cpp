@@ -61,6 +61,11 @@ void* lruCacheGet(LruCache *cache, u64 key) {
   return elem.data;
 }
 
+bool lruCacheContains(LruCache *cache, u64 key) {
+  auto it = cache->map.find(key);
+  return (it != cache->map.end()) && it->second.data;
+}
+
 void logCacheStats(int level, LruCache *cache, const char *msg) {
   log(level, "%s cache stats: %llu lookups / %llu misses / %llu evictions",
       msg, cache->lookups, cache->misses, cache->evictions);
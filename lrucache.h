@@ -33,6 +33,9 @@ void lruCachePut(LruCache *cache, u64 key, void *value);
 /* Looks up the given key, returns the corresponding value and updates the LRU access order */
 void* lruCacheGet(LruCache *cache, u64 key);
 
+/* Returns true if the key is in the cache. Does not update the access order or the statistics. */
+bool lruCacheContains(LruCache *cache, u64 key);
+
 /* Print cache statistics */
 void logCacheStats(int level, LruCache *cache, const char *msg);
 
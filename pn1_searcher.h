@@ -0,0 +1,41 @@
+#ifndef __PN1_SEARCHER_H__
+#define __PN1_SEARCHER_H__
+#include "defines.h"
+
+/**
+ * A first-level searcher for PN2. PN2 hands it a leaf's board and builds the
+ * leaf's children from the (dis)proof numbers it reports. Implemented by Pns
+ * (plain PN search) and Dfpn (depth-first PN search). See cfgPn1Engine.
+ */
+class Pn1Searcher {
+
+public:
+
+  virtual ~Pn1Searcher() { }
+
+  /* Searches b, discarding the results of any previous search. */
+  virtual void search(Board *b) = 0;
+
+  /* Returns the proof number of the last board searched. */
+  virtual u64 getProof() = 0;
+
+  /* Returns the disproof number of the last board searched. */
+  virtual u64 getDisproof() = 0;
+
+  /**
+   * Copies the moves of the last board searched, along with the (dis)proof
+   * numbers of the positions they lead to.
+   * @return The number of moves, or 0 if the board was scored without being
+   * expanded (no legal moves or EGTB).
+   */
+  virtual int getChildren(Move *m, u64 *proof, u64 *disproof) = 0;
+
+  /**
+   * Creates a searcher of the same kind and size for searching in parallel.
+   * Caches that are safe to share are shared with it.
+   */
+  virtual Pn1Searcher* newWorker() = 0;
+
+};
+
+#endif
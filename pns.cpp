@@ -1,7 +1,13 @@
+#include <algorithm>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "board.h"
 #include "configfile.h"
 #include "egtb.h"
@@ -13,17 +19,147 @@
 #include "timer.h"
 #include "zobrist.h"
 
-Pns::Pns(int nodes, int edges, Pns* pn1, string bookFileName) {
+/* Identifies book images. See Pns::saveImage(). */
+const char BOOK_IMAGE_MAGIC[8] = { 'C', 'O', 'L', 'I', 'B', 'O', 'O', 'K' };
+
+/* Book image sections start at multiples of this. */
+const u64 BOOK_IMAGE_ALIGN = 4096;
+
+/**
+ * Header of a book image. Element sizes are recorded so that images saved
+ * with a different memory layout are rejected.
+ */
+typedef struct {
+  char magic[8];
+  u32 nodeSize, childSize, edgeSize, transEntrySize;
+  Board board;
+  u64 numNodes, numChildren, numEdges;
+  u64 nodeOffset, childOffset, edgeOffset, transOffset;
+} BookImageHeader;
+
+/* VLQ books are read and written in chunks of this many bytes. */
+const int BOOK_BUFFER_SIZE = 1 << 20;
+
+/* Upper bound on the size of a child entry followed by a node header in a VLQ book. */
+const int BOOK_MAX_RECORD = 32;
+
+/**
+ * A VLQ book file accessed through a memory buffer. When reading, end marks
+ * the end of the data read so far.
+ */
+typedef struct {
+  FILE *f;
+  byte *start, *p, *end;
+} BookBuffer;
+
+/* Writes out the buffer if it is almost full, or unconditionally if force is set. */
+void flushBookBuffer(BookBuffer *b, bool force) {
+  if (force || (b->p - b->start > BOOK_BUFFER_SIZE - BOOK_MAX_RECORD)) {
+    fwrite(b->start, 1, b->p - b->start, b->f);
+    b->p = b->start;
+  }
+}
+
+/* Reads more data if fewer than BOOK_MAX_RECORD unread bytes are left. */
+void fillBookBuffer(BookBuffer *b) {
+  int left = b->end - b->p;
+  if (left < BOOK_MAX_RECORD) {
+    memmove(b->start, b->p, left);
+    b->p = b->start;
+    b->end = b->start + left + fread(b->start + left, 1, BOOK_BUFFER_SIZE - left, b->f);
+  }
+}
+
+/* A node whose children are being loaded, along with its position. */
+typedef struct {
+  int t;
+  int i; /* next child to load */
+  u64 z;
+  Board b;
+} BookLoadFrame;
+
+/**
+ * Upper bound on the size of a journal record: its length, the board, two
+ * bytes of flags and counts, then up to MAX_MOVES moves with their proof and
+ * disproof numbers. See Pns::journalExpansion().
+ */
+const int JOURNAL_MAX_RECORD = sizeof(u32) + sizeof(Board) + 2 + MAX_MOVES * (2 + 10 + 10);
+
+/* Encodes a (dis)proof number for the book and the journal. ∞ becomes 0. */
+u64 encodePn(u64 x) {
+  return (x == INFTY64) ? 0 : (x + 1);
+}
+
+/* Reverses encodePn(). */
+u64 decodePn(u64 x) {
+  return (x == 0) ? INFTY64 : (x - 1);
+}
+
+Pns::Pns(int maxNodes, int maxMemory, Pn1Searcher* pn1, string bookFileName) {
   this->pn1 = pn1;
   this->bookFileName = bookFileName;
+  this->maxMemory = (u64)maxMemory << 20;
+  imageBook = false;
+  journal = NULL;
+  savePid = 0;
+  seenGeneration = 1;
   trim = (pn1 != NULL); // trim non-winning nodes in PN2, but not in PN1
-
-  node = (PnsNode*)malloc(nodes * sizeof(PnsNode));
-  nodeAllocator = new Allocator("node", nodes);
-  edge = (PnsNodeList*)malloc(edges * sizeof(PnsNodeList));
-  edgeAllocator = new Allocator("edge", edges);
+  probeCache = (!pn1 && cfgEgtbProbeCache) ? new ScoreCache(cfgEgtbProbeCache) : NULL;
+  solvedCache = (!pn1 && cfgPn1SolvedCache) ? new ScoreCache(cfgPn1SolvedCache) : NULL;
+
+  // The pools start small and isFull() grows them ahead of each expansion.
+  // Under a memory cap, any one of them may grow to fill it, and isFull()
+  // keeps the total allocated within it. Otherwise, each expansion adds at
+  // most MAX_MOVES child slots and parent links.
+  u64 nodes = maxNodes, links = (u64)maxNodes * MAX_MOVES;
+  if (maxMemory) {
+    nodes = MIN(nodes, this->maxMemory / sizeof(PnsNode));
+    links = this->maxMemory / sizeof(PnsChild);
+  }
+  nodes = MIN(nodes, (u64)MAX_POOL_SIZE);
+  links = MIN(links, (u64)MAX_POOL_SIZE);
+
+  nodeAllocator = new Allocator("node", (void**)&node, sizeof(PnsNode), nodes);
+  trans = new TransTable(MIN(nodes, (u64)INITIAL_TRANS_SIZE));
+  childAllocator = new BlockAllocator("child", (void**)&child, sizeof(PnsChild),
+                                      links, MAX_MOVES);
+  edgeAllocator = new Allocator("edge", (void**)&edge, sizeof(PnsNodeList), links);
+  pthread_mutex_init(&poolLock, NULL);
+  nodeAllocator->setGrowLock(&poolLock);
+  childAllocator->setGrowLock(&poolLock);
+  edgeAllocator->setGrowLock(&poolLock);
+  trans->setGrowLock(&poolLock);
 
   reset();
+
+  pn1Pool = searchPool = NULL;
+  if (!pn1 && (cfgPn1Threads > 1)) {
+    // Let expansions through while descents keep coming.
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&treeLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    searchPool = new WorkerPool(cfgPn1Threads, runSearchThread, this);
+  }
+  if (pn1) {
+    pn1Workers.push_back(pn1);
+    for (int i = 1; i < cfgPn2Threads; i++) {
+      pn1Workers.push_back(pn1->newWorker());
+    }
+    if (pn1Workers.size() > 1) {
+      pn1Boards.resize(pn1Workers.size());
+      pn1Pool = new WorkerPool(pn1Workers.size(), runPn1Worker, this);
+    }
+  }
+}
+
+Pns::~Pns() {
+  delete pn1Pool;
+  if (searchPool) {
+    delete searchPool;
+    pthread_rwlock_destroy(&treeLock);
+  }
 }
 
 u64 Pns::getProof() {
@@ -34,18 +170,36 @@ u64 Pns::getDisproof() {
   return node[0].disproof;
 }
 
+u64 Pns::memoryUsage() {
+  return nodeAllocator->memory() + childAllocator->memory() +
+    edgeAllocator->memory() + trans->memory();
+}
+
+bool Pns::isFull() {
+  // Ensure a copious amount of resources left. They are necessary sometimes
+  // for cascading depth updates. Growing now, while we can still stop
+  // cleanly, means that the expansion itself never runs out of memory.
+  u64 budget = maxMemory ? (maxMemory - MIN(maxMemory, memoryUsage())) : INFTY64;
+  return !nodeAllocator->reserve(10000, &budget) ||
+    !edgeAllocator->reserve(10000, &budget) ||
+    !childAllocator->reserve(MAX_MOVES, &budget) ||
+    !trans->reserve(trans->size() + 10000, &budget);
+}
+
 void Pns::reset() {
   nodeAllocator->reset();
   edgeAllocator->reset();
-  trans.clear();
+  childAllocator->reset();
+  trans->clear();
   numEgtbLookups = 0;
+  mpnPath.clear();
 }
 
 void Pns::collapse() {
   reset();
   u64 z = getZobrist(&board);
   allocateLeaf(1, 1, 0, z);
-  trans[z] = { 0, NIL };
+  trans->insert(z, 0, NIL);
 }
 
 bool Pns::isSolved(int t) {
@@ -69,6 +223,7 @@ int Pns::allocateLeaf(u64 p, u64 d, int depth, u64 zobrist) {
   node[t].disproof = d;
   node[t].zobrist = zobrist;
   node[t].child = node[t].parent = NIL;
+  node[t].numChildren = 0;
   node[t].depth = depth;
   return t;
 }
@@ -80,26 +235,22 @@ void Pns::addParent(int childIndex, int parentIndex) {
   node[childIndex].parent = e;
 }
 
-void Pns::prependChild(int parentIndex, int childIndex, Move m) {
-  int e = edgeAllocator->alloc();
-  edge[e].node = childIndex;
-  edge[e].move = m;
-  edge[e].next = node[parentIndex].child;
-  node[parentIndex].child = e;
-  floatRight(e);
+bool Pns::allocateChildren(int t, int size) {
+  int start = childAllocator->alloc(size);
+  if (start == NIL) {
+    return false;
+  }
+  node[t].child = start;
+  node[t].numChildren = size;
+  return true;
 }
 
-int Pns::appendChild(int parentIndex, int childIndex, Move m, int tail) {
-  int e = edgeAllocator->alloc();
-  edge[e].node = childIndex;
-  edge[e].move = m;
-  edge[e].next = NIL;
-  if (tail == NIL) {
-    node[parentIndex].child = e;
-  } else {
-    edge[tail].next = e;
+void Pns::freeChildren(int t) {
+  if (node[t].numChildren) {
+    childAllocator->free(node[t].child, node[t].numChildren);
   }
-  return e;
+  node[t].child = NIL;
+  node[t].numChildren = 0;
 }
 
 void Pns::printTree(int t, int level, int maxLevels) {
@@ -108,9 +259,9 @@ void Pns::printTree(int t, int level, int maxLevels) {
   }
 
   string s(4 * level, ' ');
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
-    Move m = edge[e].move;
-    int c = edge[e].node;
+  for (int i = 0; i < node[t].numChildren; i++) {
+    Move m = child[node[t].child + i].move;
+    int c = child[node[t].child + i].node;
 
     stringstream ss;
     ss << s << getLongMoveName(m) << " -> "
@@ -130,11 +281,11 @@ int Pns::nodeCmp(int u, int v) {
 }
 
 void Pns::replaceChild(int parent, int from, int to) {
-  int e = node[parent].child;
-  while (edge[e].node != from) {
-    e = edge[e].next;
+  int i = node[parent].child;
+  while (child[i].node != from) {
+    i++;
   }
-  edge[e].node = to;
+  child[i].node = to;
 }
 
 void Pns::substituteClones(int c) {
@@ -142,9 +293,9 @@ void Pns::substituteClones(int c) {
     return; // nothing to clone
   }
 
-  auto it = trans.find(node[c].zobrist); // must exist in transposition table
-  assert(it != trans.end());
-  int clone = it->second.second;         // if NIL, don't allocate it yet
+  TransEntry *te = trans->find(node[c].zobrist); // must exist in transposition table
+  assert(te);
+  int clone = te->clone;                 // if NIL, don't allocate it yet
 
   // Sadly, we cannot call deleteParentLink() while iterating the parent list.
   // So we need to repeatedly check and delete the *next* element.
@@ -165,13 +316,13 @@ void Pns::substituteClones(int c) {
       // lazy clone creation
       if (clone == NIL) {
         clone = allocateLeaf(INFTY64, INFTY64, INFTY, node[c].zobrist);
-        it->second.second = clone;
+        te->clone = clone; // no updates yet, so te is still valid
       }
 
       // fix the parent
       addParent(clone, p);
       replaceChild(p, c, clone);
-      update(p, clone);    // starts by reordering the clone in p's child list
+      queueUpdate(p, clone);
     } else {
       e = edge[e].next;
     }
@@ -180,6 +331,7 @@ void Pns::substituteClones(int c) {
   // update the head of the list in case we deleted the first element
   node[c].parent = edge[tmpEdge].next;
   edgeAllocator->free(tmpEdge);
+  runUpdates();
 }
 
 void Pns::updateDepth(int t, int d) {
@@ -192,16 +344,16 @@ void Pns::updateDepth(int t, int d) {
     node[t].depth = d;
     substituteClones(t); // in case the new child violates some depth differentials
 
-    for (int e = node[t].child; e != NIL; e = edge[e].next) {
-      updateDepth(edge[e].node, d + 1);
+    for (int i = 0; i < node[t].numChildren; i++) {
+      updateDepth(child[node[t].child + i].node, d + 1);
     }
   }
 }
 
 void Pns::updateChildDepths(int t) {
   int target = 1 + node[t].depth;
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
-    int c = edge[e].node;
+  for (int i = 0; i < node[t].numChildren; i++) {
+    int c = child[node[t].child + i].node;
     if (node[c].depth > target) {
       updateDepth(c, 1 + target);
     }
@@ -213,23 +365,47 @@ void Pns::updateChildDepths(int t) {
 }
 
 int Pns::selectMpn(int startNode, Board *b) {
-  int t = startNode;
-  string s;
-  while (node[t].child != NIL) {
+  // Keep the part of the last path that still follows first children.
+  unsigned k = 0;
+  if (!mpnPath.empty() &&
+      (mpnPath[0].node == startNode) &&
+      (mpnPath[0].board.side == b->side) &&
+      !memcmp(mpnPath[0].board.bb, b->bb, sizeof(b->bb))) {
+    k = 1;
+    while ((k < mpnPath.size()) &&
+           node[mpnPath[k - 1].node].numChildren &&
+           (child[node[mpnPath[k - 1].node].child].node == mpnPath[k].node)) {
+      k++;
+    }
+  }
+  if (k) {
+    mpnPath.resize(k);
+    *b = mpnPath[k - 1].board;
+    mpnMoves.resize(mpnPath[k - 1].movesLength);
+  } else {
+    mpnPath.clear();
+    mpnPath.push_back({ startNode, *b, 0 });
+    mpnMoves.clear();
+  }
+
+  int t = mpnPath.back().node;
+  while (node[t].numChildren) {
 
-    int e = node[t].child; // keep selecting the first child
+    PnsChild *c = &child[node[t].child]; // keep selecting the first child
 
     if (pn1) {
-      s += ' ' + getMoveName(b, edge[e].move);
+      mpnMoves += ' ' + getMoveName(b, c->move);
     }
-    makeMove(b, edge[e].move);
-    t = edge[e].node;
+    makeMove(b, c->move);
+    t = c->node;
+    mpnPath.push_back({ t, *b, (int)mpnMoves.size() });
   }
 
   if (pn1) {
-    log(LOG_INFO, "Score %llu/%llu, size %d, expanding MPN (%llu/%llu)%s",
-        node[startNode].proof, node[startNode].disproof, nodeAllocator->used(),
-        node[t].proof, node[t].disproof, s.c_str());
+    log(LOG_INFO, "Score %llu/%llu, size %d (%llu MB), expanding MPN (%llu/%llu)%s",
+        (u64)node[startNode].proof, (u64)node[startNode].disproof,
+        nodeAllocator->used(), memoryUsage() >> 20,
+        (u64)node[t].proof, (u64)node[t].disproof, mpnMoves.c_str());
   }
   return t;
 }
@@ -258,28 +434,44 @@ void Pns::setScoreEgtb(int t, int score) {
   }
 }
 
-int Pns::copyMovesFromPn1() {
-  int n = 0;
-  for (int e = pn1->node[0].child; e != NIL; e = pn1->edge[e].next) {
-    proof[n] = pn1->node[pn1->edge[e].node].proof;
-    disproof[n] = pn1->node[pn1->edge[e].node].disproof;
-    move[n++] = pn1->edge[e].move;
+void Pns::search(Board *b) {
+  board = *b;
+  collapse();
+  analyze();
+}
+
+int Pns::getChildren(Move *m, u64 *proof, u64 *disproof) {
+  int n = node[0].numChildren;
+  for (int i = 0; i < n; i++) {
+    PnsChild *c = &child[node[0].child + i];
+    m[i] = c->move;
+    proof[i] = node[c->node].proof;
+    disproof[i] = node[c->node].disproof;
   }
   return n;
 }
 
+Pn1Searcher* Pns::newWorker() {
+  Pns *w = new Pns(nodeAllocator->capacity(), maxMemory >> 20);
+  delete w->probeCache;
+  w->probeCache = probeCache;
+  delete w->solvedCache;
+  w->solvedCache = solvedCache;
+  return w;
+}
+
 int Pns::zobristLookup(u64 z, int depth, u64 proof, u64 disproof) {
-  auto it = trans.find(z);
+  TransEntry *te = trans->find(z);
 
-  if (it == trans.end()) {
+  if (!te) {
     // first time generating this position
     int c = allocateLeaf(proof, disproof, depth, z);
-    trans[z] = { c, NIL };
+    trans->insert(z, c, NIL);
     return c;
   }
 
-  int orig = it->second.first;
-  int rep = it->second.second;
+  int orig = te->orig;
+  int rep = te->clone;
 
   if (node[orig].depth >= depth) {
     return orig;
@@ -293,110 +485,225 @@ int Pns::zobristLookup(u64 z, int depth, u64 proof, u64 disproof) {
   // repetitions, but also discourages long convoluted paths.
   if (rep == NIL) {
     rep = allocateLeaf(INFTY64, INFTY64, INFTY, z);
-    it->second.second = rep;
+    te->clone = rep;
   }
   return rep;
 }
 
-bool Pns::expand(int t, Board *b) {
-  if (!pn1) {                     // no EGTB lookups in PN2
-    int score = egtbLookup(b);
-    if (score != EGTB_UNKNOWN) {
-      setScoreEgtb(t, score);
-      return true;
+int Pns::cachedEgtbLookup(Board *b) {
+  int numPieces = popCount(b->bb[BB_WALL]) + popCount(b->bb[BB_BALL]);
+  if (numPieces > EGTB_MEN) {
+    return egtbLookupExtended(b, cfgEgtbCaptureDepth);
+  }
+  if (!probeCache) {
+    return egtbLookup(b);
+  }
+
+  u64 z = getZobrist(b);
+  int score;
+  if (!probeCache->get(z, &score)) {
+    score = egtbLookup(b);
+    if (score != INFTY) { // don't cache errors
+      probeCache->put(z, score);
     }
   }
+  return score;
+}
 
-  int nc;
-  if (pn1) {
-    pn1->board = *b;
-    pn1->collapse();
-    pn1->analyze();
-    if (!pn1->getProof()) {
-      // Handle the following rare scenario in PN2: t has a losing child c. We
-      // have c in the hash but it is unproven. The correct solution would be to
-      // collapse c and mark it as lost (also c's clone if there is one). But this
-      // involves calling update() during expand(). That way madness lies. Rather,
-      // we mark t as won and leave it childless. This means that we will at some
-      // point have to rediscover the proof for c, but that seems acceptable.
-      node[t].proof = 0;
-      node[t].disproof = INFTY64;
-      return true;
-    }
-    nc = copyMovesFromPn1();
-  } else {
-    nc = getAllMoves(b, move, FORWARD);
+bool Pns::expand(int t, Board *b) {
+  if (pn1) {                      // no EGTB lookups in PN2
+    pn1->search(b);
+    return expandFromPn1(t, b, pn1);
+  }
+
+  PnsLeaf l;
+  l.node = t;
+  l.board = *b;
+  l.zobrist = node[t].zobrist;
+  evaluateLeaf(&l);
+  return expandLeaf(&l);
+}
+
+void Pns::evaluateLeaf(PnsLeaf *l) {
+  // Positions solved by earlier PN1 searches score like EGTB positions.
+  if (solvedCache && solvedCache->get(l->zobrist, &l->score)) {
+    return;
+  }
+
+  Board b = l->board; // the lookup clobbers it
+  l->score = cachedEgtbLookup(&b);
+  if (l->score == EGTB_UNKNOWN) {
+    l->numMoves = getAllMoves(&l->board, l->move, FORWARD);
+  }
+}
+
+bool Pns::expandLeaf(PnsLeaf *l) {
+  if (l->score != EGTB_UNKNOWN) {
+    setScoreEgtb(l->node, l->score);
+    return true;
   }
-  if (!nc) {                                  // no legal moves
-    setScoreNoMoves(t, b);
+  if (!l->numMoves) {                         // no legal moves
+    setScoreNoMoves(l->node, &l->board);
     return true;
   }
+  return addChildren(l->node, &l->board, l->move, l->numMoves);
+}
 
-  // Ensure a copious amount of resources left. They are necessary sometimes
-  // for cascading depth updates.
-  if (nodeAllocator->available() < 10000 ||
-      edgeAllocator->available() < 10000) {
+bool Pns::expandFromPn1(int t, Board *b, Pn1Searcher *src) {
+  if (!src->getProof()) {
+    // Handle the following rare scenario in PN2: t has a losing child c. We
+    // have c in the hash but it is unproven. The correct solution would be to
+    // collapse c and mark it as lost (also c's clone if there is one). But this
+    // involves calling update() during expand(). That way madness lies. Rather,
+    // we mark t as won and leave it childless. This means that we will at some
+    // point have to rediscover the proof for c, but that seems acceptable.
+    node[t].proof = 0;
+    node[t].disproof = INFTY64;
+    return true;
+  }
+
+  int nc = src->getChildren(move, proof, disproof);
+  if (!nc) {
+    // PN1 scored the position without expanding it (no legal moves or EGTB)
+    node[t].proof = src->getProof();
+    node[t].disproof = src->getDisproof();
+    assert(isSolved(t) || isDrawn(t));
+    return true;
+  }
+
+  return addChildren(t, b, move, nc);
+}
+
+bool Pns::addChildren(int t, Board *b, Move *m, int nc) {
+  // The child pool can be fragmented, so check for a block of nc as well.
+  if (isFull() || !allocateChildren(t, nc)) {
     return false;
   }
 
   u64 z = getZobrist(b);
-  // nodes are prepended, so copy moves from last to first
+  // fill in the block from last to first, keeping the filled part sorted
   while (nc--) {
-    u64 z2 = updateZobrist(z, b, move[nc]);
+    u64 z2 = updateZobrist(z, b, m[nc]);
     u64 childP = pn1 ? proof[nc]: 1;
     u64 childD = pn1 ? disproof[nc]: 1;
     int c = zobristLookup(z2, node[t].depth + 1, childP, childD);
     addParent(c, t);
-    prependChild(t, c, move[nc]);
+    child[node[t].child + nc] = { m[nc], c };
+    floatRight(t, node[t].child + nc);
   }
 
   return true;
 }
 
-void Pns::floatRight(int e) {
-  int u = edge[e].node;
-  while ((edge[e].next != NIL) &&
-         nodeCmp(u, edge[edge[e].next].node) == 1) {
-    int f = edge[e].next;
-    Move mtmp = edge[e].move;
-    edge[e].move = edge[f].move;
-    edge[f].move = mtmp;
-
-    edge[e].node = edge[f].node;
-    edge[f].node = u;
-
-    e = f;
+void Pns::floatRight(int t, int e) {
+  int end = node[t].child + node[t].numChildren;
+  PnsChild x = child[e];
+  while ((e + 1 < end) && nodeCmp(x.node, child[e + 1].node) == 1) {
+    child[e] = child[e + 1];
+    e++;
   }
+  child[e] = x;
 }
 
 void Pns::reorder(int p, int c) {
   // 1. Find c. If c is better than its predecessor, move it to the beginning
-  // of the list. If c is already the first child, do nothing.
-  int e = node[p].child;
-  if (edge[e].node != c) {
-    while (edge[edge[e].next].node != c) {
-      e = edge[e].next;
+  // of the block. If c is already the first child, do nothing.
+  int first = node[p].child;
+  int e = first;
+  while (child[e].node != c) {
+    e++;
+  }
+  if ((e > first) && nodeCmp(child[e - 1].node, c) == 1) {
+    PnsChild x = child[e];
+    memmove(&child[first + 1], &child[first], (e - first) * sizeof(PnsChild));
+    child[first] = x;
+    e = first;
+  }
+
+  // 2. Now all the children before c are better than c. Move c rightwards
+  // while necessary.
+  floatRight(p, e);
+}
+
+void Pns::sortChildren(int t, int last) {
+  // insertion sort, growing the sorted tail leftwards
+  for (int e = last; e >= node[t].child; e--) {
+    floatRight(t, e);
+  }
+}
+
+u32& Pns::stampOf(int t) {
+  if (t >= (int)stamp.size()) {
+    stamp.resize(nodeAllocator->highWater(), 0);
+    changedChild.resize(nodeAllocator->highWater(), NIL);
+  }
+  return stamp[t];
+}
+
+void Pns::clearSeen() {
+  if (++seenGeneration == QUEUED) {
+    // out of generations; forget the old ones
+    for (unsigned i = 0; i < stamp.size(); i++) {
+      stamp[i] &= QUEUED;
     }
-    int f = edge[e].next;            // edge containing c
-    if (nodeCmp(edge[e].node, c) == 1) {
-      edge[e].next = edge[f].next;   // link edges before and after c
-      edge[f].next = node[p].child;  // c points to the first child
-      node[p].child = f;             // c is the first child
+    seenGeneration = 1;
+  }
+}
+
+bool Pns::markSeen(int t) {
+  u32 &s = stampOf(t);
+  if ((s & ~QUEUED) == seenGeneration) {
+    return false;
+  }
+  s = (s & QUEUED) | seenGeneration;
+  return true;
+}
+
+void Pns::queueUpdate(int t, int c) {
+  u32 &s = stampOf(t);
+  if (!(s & QUEUED)) {
+    s |= QUEUED;
+    changedChild[t] = c;
+    updateQueue.push({ node[t].depth, t });
+  } else if (changedChild[t] != c) {
+    changedChild[t] = NIL;
+  }
+}
+
+void Pns::runUpdates() {
+  while (!updateQueue.empty()) {
+    int t = updateQueue.top().second;
+    updateQueue.pop();
+    stamp[t] &= ~QUEUED;
+    // Trims may have deleted t while it was queued. Nothing is allocated
+    // meanwhile, so its slot cannot have been reused.
+    int c = changedChild[t];
+    while ((t != NIL) && nodeAllocator->isInUse(t) && recompute(t, c)) {
+      int e = node[t].parent;
+      if ((e != NIL) && (edge[e].next == NIL) && updateQueue.empty()) {
+        // Sole parent and nothing else pending: skip the queue.
+        c = t;
+        t = edge[e].node;
+      } else {
+        for (; e != NIL; e = edge[e].next) {
+          queueUpdate(edge[e].node, t);
+        }
+        t = NIL;
+      }
     }
-    e = f;                           // e is the edge containing c
   }
+}
 
-  // 2. Now e is the edge containing c and all the nodes before c in the list
-  // are better than c. Move c rightwards while necessary. We move c by
-  // swapping payloads, not by changing pointers.
-  floatRight(e);
+void Pns::update(int t) {
+  queueUpdate(t, NIL);
+  runUpdates();
 }
 
-void Pns::update(int t, int c) {
+bool Pns::recompute(int t, int c) {
   u64 origP = node[t].proof, origD = node[t].disproof;
   bool changed = true;
   bool wasSolved = isSolved(t);
-  if (node[t].child != NIL) {
+  if (node[t].numChildren) {
     // Here we used to assert that, with trimming enabled, t shouldn't be
     // called again if t is won. That is, assert(!trim || (origP >
     // 0)). However, this does happen in practice when a descendant d is
@@ -404,49 +711,58 @@ void Pns::update(int t, int c) {
 
     // If t has no children after expand(), then it's proven, so it already
     // has correct P/D values.
-    if (c != INFTY) {
+    if (c != NIL) {
       reorder(t, c);
     }
+    // If several children changed, some may still be out of order. Find the
+    // last child that is worse than its right neighbor.
     u64 p = INFTY64, d = 0;
-    for (int e = node[t].child; e != NIL; e = edge[e].next) {
-      int c = edge[e].node;
+    int last = NIL, prev = NIL;
+    for (int e = node[t].child; e < node[t].child + node[t].numChildren; e++) {
+      int c = child[e].node;
       p = MIN(p, node[c].disproof);
       d = MIN(d + node[c].proof, INFTY64);
+      if ((prev != NIL) &&
+          ((node[prev].disproof > node[c].disproof) ||
+           ((node[prev].disproof == node[c].disproof) &&
+            (node[prev].proof < node[c].proof)))) {
+        last = e - 1;
+      }
+      prev = c;
     }
-    if (origP != p || origD != d) {
-      node[t].proof = p;
-      node[t].disproof = d;
-    } else {
-      changed = false;
+    if (last != NIL) {
+      sortChildren(t, last);
     }
+    // Compare the stored numbers, which saturate. Sums beyond 32 bits would
+    // otherwise always look changed and propagate all the way up.
+    node[t].proof = p;
+    node[t].disproof = d;
+    changed = ((u64)node[t].proof != origP) || ((u64)node[t].disproof != origD);
     trimNonWinning(t);
   }
 
   if (!wasSolved && isSolved(t)) {
     solveRepetition(t);
   }
-  if (changed) {
-    for (int e = node[t].parent; e != NIL; e = edge[e].next) {
-      update(edge[e].node, t);
-    }
-  }
+  return changed;
 }
 
 void Pns::trimNonWinning(int t) {
   if (!trim ||                          // trimming not enabled
       (node[t].proof > 0) ||            // no need to trim -- not won
-      (node[t].child == NIL)) {         // nothing to trim
+      !node[t].numChildren) {           // nothing to trim
     return;
   }
   // node is won; delete all children except the first one
-  seen.insert(t);
-  int e = edge[node[t].child].next; // start at 2nd child
-  edge[node[t].child].next = NIL;
-  while (e != NIL) {
-    int f = edge[e].next;
-    deleteParentLink(edge[e].node, t);
-    edgeAllocator->free(e);
-    e = f;
+  markSeen(t);
+  int first = node[t].child, n = node[t].numChildren;
+  node[t].numChildren = 1;
+  for (int i = first + 1; i < first + n; i++) {
+    deleteParentLink(child[i].node, t);
+  }
+  // deletions never allocate, so the tail is only reclaimed now
+  if (n > 1) {
+    childAllocator->free(first + 1, n - 1);
   }
 }
 
@@ -477,30 +793,30 @@ void Pns::deleteParentLink(int c, int p) {
 }
 
 void Pns::deleteNode(int t) {
-  if (!seen.insert(t).second) {
+  if (!markSeen(t)) {
     return;   // t was already visited during this trim
   }
-  // notify t's children to sever their links to t; delete t's edge list
-  int e = node[t].child;
+  // notify t's children to sever their links to t; delete t's child block
+  int first = node[t].child, n = node[t].numChildren;
 
-  auto it = trans.find(node[t].zobrist);
-  if (it != trans.end()) {
-    if (it->second.second == t) {
+  TransEntry *te = trans->find(node[t].zobrist);
+  if (te) {
+    if (te->clone == t) {
       // we are a clone; keep the original in the map
-      it->second.second = NIL;
+      te->clone = NIL;
     } else {
       // we are the original; if no other node links to us any longer, then
       // it is safe to delete the clone as well
-      trans.erase(it);
+      trans->erase(te);
     }
   }
 
   nodeAllocator->free(t);
-  while (e != NIL) {
-    int f = edge[e].next;
-    deleteParentLink(edge[e].node, t);
-    edgeAllocator->free(e);
-    e = f;
+  for (int i = first; i < first + n; i++) {
+    deleteParentLink(child[i].node, t);
+  }
+  if (n) {
+    childAllocator->free(first, n);
   }
 }
 
@@ -509,14 +825,14 @@ void Pns::solveRepetition(int t) {
     return; // t itself is a repetition
   }
 
-  pair<int,int> p = trans[node[t].zobrist];
-  assert(p.first == t);
+  TransEntry *te = trans->find(node[t].zobrist);
+  assert(te && te->orig == t);
 
-  int rep = p.second;
+  int rep = te->clone;
   if (rep != NIL) {
     node[rep].proof = node[t].proof;
     node[rep].disproof = node[t].disproof;
-    update(rep, INFTY);
+    queueUpdate(rep, NIL);
   }
 }
 
@@ -524,22 +840,220 @@ void Pns::analyze() {
   analyzeSubtree(0, &board);
 }
 
+int Pns::selectLeaves(int startNode, Board *b, PnsLeaf *leaf, int max) {
+  int n = 0;
+  while (n < max && !isDrawn(startNode)) {
+    leaf[n].board = *b;
+    int t = selectMpn(startNode, &leaf[n].board);
+    assert(!isSolved(t));
+    if (isDrawn(t) || (node[t].proof == VIRTUAL_PN)) {
+      break; // nothing else left to select
+    }
+    leaf[n].node = t;
+    leaf[n].proof = node[t].proof;
+    leaf[n].disproof = node[t].disproof;
+    node[t].proof = node[t].disproof = VIRTUAL_PN;
+    update(t);
+    n++;
+  }
+  return n;
+}
+
+void Pns::restoreLeaves(PnsLeaf *leaf, int n) {
+  // Since only leaves changed, this brings every node back to where it was
+  // before the selection.
+  for (int i = 0; i < n; i++) {
+    node[leaf[i].node].proof = leaf[i].proof;
+    node[leaf[i].node].disproof = leaf[i].disproof;
+    update(leaf[i].node);
+  }
+}
+
+bool Pns::isExpandable(PnsLeaf *l) {
+  // If t was trimmed away, its slot may even be reused by now.
+  int t = l->node;
+  return nodeAllocator->isInUse(t) &&
+    (node[t].zobrist == getZobrist(&l->board)) &&
+    !node[t].numChildren &&
+    !isSolved(t) && !isDrawn(t);
+}
+
+bool Pns::expandParallel(int startNode, Board *b) {
+  int n = pn1Workers.size();
+  PnsLeaf leaf[n];
+
+  int k = selectLeaves(startNode, b, leaf, n);
+  for (int i = 0; i < k; i++) {
+    pn1Boards[i] = &leaf[i].board;
+  }
+  pn1Pool->runRound(k);
+  restoreLeaves(leaf, k);
+
+  for (int i = 0; i < k; i++) {
+    if (isExpandable(&leaf[i])) {
+      if (!expandFromPn1(leaf[i].node, &leaf[i].board, pn1Workers[i])) {
+        return false;
+      }
+      journalExpansion(leaf[i].node, &leaf[i].board);
+      markTouched(leaf[i].node);
+      clearSeen();
+      update(leaf[i].node);
+      updateChildDepths(leaf[i].node);
+    }
+  }
+  return true;
+}
+
+void Pns::runPn1Worker(void *arg, int i) {
+  Pns *pns = (Pns*)arg;
+  pns->pn1Workers[i]->search(pns->pn1Boards[i]);
+}
+
+bool Pns::searchParallel(int startNode, Board *b) {
+  searchStart = startNode;
+  searchBoard = *b;
+  searchFull = false;
+  busy.assign(nodeAllocator->highWater(), 0);
+  searchPool->runRound(cfgPn1Threads);
+  return !searchFull;
+}
+
+void Pns::runSearchThread(void *arg, int i) {
+  ((Pns*)arg)->searchThread();
+}
+
+void Pns::searchThread() {
+  vector<int> path;
+  PnsLeaf l;
+
+  while (true) {
+    pthread_rwlock_rdlock(&treeLock);
+    bool done = searchFull || isSolved(searchStart) || isDrawn(searchStart);
+    if (!done) {
+      l.board = searchBoard;
+      l.node = selectShared(searchStart, &l.board, &path);
+      if (l.node != NIL) {
+        l.zobrist = node[l.node].zobrist;
+      }
+    }
+    pthread_rwlock_unlock(&treeLock);
+
+    if (done) {
+      return;
+    }
+    if (l.node == NIL) {
+      // Every leaf worth expanding is taken. Let their threads finish.
+      sched_yield();
+      continue;
+    }
+
+    evaluateLeaf(&l);
+
+    pthread_rwlock_wrlock(&treeLock);
+    // Nothing else expands the leaf while we hold it, but the search may
+    // have ended in the meantime.
+    if (!searchFull && !isSolved(searchStart) && !isDrawn(searchStart) &&
+        !node[l.node].numChildren && !isSolved(l.node) && !isDrawn(l.node)) {
+      if (expandLeaf(&l)) {
+        markTouched(l.node);
+        clearSeen();
+        update(l.node);
+        updateChildDepths(l.node);
+        if ((int)busy.size() < nodeAllocator->highWater()) {
+          busy.resize(nodeAllocator->highWater(), 0);
+        }
+      } else {
+        searchFull = true;
+      }
+    }
+    releasePath(&path);
+    pthread_rwlock_unlock(&treeLock);
+  }
+}
+
+int Pns::selectShared(int startNode, Board *b, vector<int> *path) {
+  path->clear();
+  int t = startNode;
+  while (true) {
+    path->push_back(t);
+    u32 prev = __atomic_fetch_add(&busy[t], 1, __ATOMIC_RELAXED);
+    if (!node[t].numChildren) {
+      if (prev) {
+        // Someone else is expanding this leaf.
+        releasePath(path);
+        return NIL;
+      }
+      return t;
+    }
+
+    // Children are sorted best first. Count every thread already below a
+    // child as multiplying its disproof number, so that threads spread out
+    // over the most promising children instead of piling onto the first.
+    int best = NIL;
+    u64 bestD = INFTY64;
+    for (int i = 0; i < node[t].numChildren; i++) {
+      PnsChild *c = &child[node[t].child + i];
+      if (isSolved(c->node) || isDrawn(c->node)) {
+        continue;
+      }
+      u64 d = node[c->node].disproof;
+      u32 k = __atomic_load_n(&busy[c->node], __ATOMIC_RELAXED);
+      d = (d > INFTY64 / (k + 1)) ? INFTY64 : d * (k + 1);
+      if ((best == NIL) || (d < bestD)) {
+        best = i;
+        bestD = d;
+      }
+      if (!k) {
+        break; // nothing later can beat an idle child
+      }
+    }
+
+    if (best == NIL) {
+      releasePath(path);
+      return NIL;
+    }
+    PnsChild *c = &child[node[t].child + best];
+    makeMove(b, c->move);
+    t = c->node;
+  }
+}
+
+void Pns::releasePath(vector<int> *path) {
+  for (int t: *path) {
+    __atomic_fetch_sub(&busy[t], 1, __ATOMIC_RELAXED);
+  }
+  path->clear();
+}
+
 void Pns::analyzeSubtree(int startNode, Board* b) {
   bool full = false;
   Timer timer(cfgSaveEvery * 1000); // convert seconds to milliseconds
+  Timer syncTimer(cfgJournalSyncEvery * 1000);
   while (!full && !isSolved(startNode) && !isDrawn(startNode)) {
-    Board current = *b;
-    int mpn = selectMpn(startNode, &current);
-    assert(!isSolved(mpn));
-    if (expand(mpn, &current)) {
-      seen.clear();
-      update(mpn, INFTY);
-      updateChildDepths(mpn);
-      if (pn1 && timer.ticked()) {
-        save();
-      }
+    if (searchPool) {
+      full = !searchParallel(startNode, b);
+    } else if (pn1Pool) {
+      full = !expandParallel(startNode, b);
     } else {
-      full = true;
+      Board current = *b;
+      int mpn = selectMpn(startNode, &current);
+      assert(!isSolved(mpn));
+      if (expand(mpn, &current)) {
+        journalExpansion(mpn, &current);
+        markTouched(mpn);
+        clearSeen();
+        update(mpn);
+        updateChildDepths(mpn);
+      } else {
+        full = true;
+      }
+    }
+    if (!full && pn1) {
+      if (timer.ticked()) {
+        cfgBackgroundSave ? saveInBackground() : save();
+      } else if (syncTimer.ticked()) {
+        syncJournal();
+      }
     }
   }
   // verifyConsistencyWrapper();
@@ -547,11 +1061,31 @@ void Pns::analyzeSubtree(int startNode, Board* b) {
     log(LOG_INFO, "PN1 complete, score %s/%s, %d nodes, %d edges, %d EGTB probes",
         pnAsString(node[startNode].proof).c_str(),
         pnAsString(node[startNode].disproof).c_str(),
-        nodeAllocator->used(), edgeAllocator->used(), numEgtbLookups);
+        nodeAllocator->used(), edgeAllocator->used() + childAllocator->used(),
+        numEgtbLookups);
+    if (probeCache) {
+      probeCache->logStats(LOG_DEBUG, "EGTB probe");
+    }
+    if (solvedCache) {
+      cacheSolvedNodes();
+      solvedCache->logStats(LOG_DEBUG, "PN1 solved position");
+    }
     printTree(startNode, 0, 0);
   }
 }
 
+void Pns::cacheSolvedNodes() {
+  for (int t = 0; t < nodeAllocator->highWater(); t++) {
+    if (nodeAllocator->isInUse(t)) {
+      if (!node[t].proof) {
+        solvedCache->put(node[t].zobrist, 1);
+      } else if (!node[t].disproof) {
+        solvedCache->put(node[t].zobrist, -1);
+      }
+    }
+  }
+}
+
 void Pns::analyzeString(string input) {
   Board b;
   int startNode;
@@ -563,13 +1097,13 @@ void Pns::analyzeString(string input) {
       die("Incorrect FEN string given.");
     }
     u64 z = getZobrist(&b);
-    auto it = trans.find(z);
+    TransEntry *te = trans->find(z);
 
-    if (it == trans.end()) {
+    if (!te) {
       die("Position does not appear in tree.");
     }
 
-    startNode = it->second.first;
+    startNode = te->orig;
 
   } else {
 
@@ -613,132 +1147,468 @@ int Pns::makeMoveSequence(Board* b, int numMoveStrings, string* moveStrings) {
 
     makeMove(b, m[j]);
     u64 z = getZobrist(b);
-    auto it = trans.find(z);
+    TransEntry *te = trans->find(z);
 
-    if (it == trans.end()) {
+    if (!te) {
       die("The move [%s] takes us outside the tree.", san[j].c_str());
     }
-    result = it->second.first;
+    result = te->orig;
   }
 
   return result;
 }
 
-void Pns::saveHelper(int t, FILE* f, unordered_map<int,int>* map, int* nextAvailable) {
-  byte numChildren = 0;
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
-    numChildren++;
-  }
+void Pns::saveNodeHeader(int t, byte** p) {
+  byte numChildren = node[t].numChildren;
 
   // Emit the number of children and the depth.
-  fwrite(&numChildren, 1, 1, f);
-  writeVlq(node[t].depth, f);
+  *(*p)++ = numChildren;
+  writeVlq(node[t].depth, p);
 
   // For leaves, emit the encoded proof / disproof numbers. Since ∞ is a
   // frequent value and would take 9 bytes in 7-bit VLQ encoding, rename it to
   // 0, pushing all other value upwards
   if (!numChildren) {
-    u64 p = (node[t].proof == INFTY64) ? 0 : (node[t].proof + 1);
-    u64 d = (node[t].disproof == INFTY64) ? 0 : (node[t].disproof + 1);
-    writeVlq(p, f);
-    writeVlq(d, f);
+    writeVlq(encodePn(node[t].proof), p);
+    writeVlq(encodePn(node[t].disproof), p);
   }
+}
+
+void Pns::saveHelper(FILE* f) {
+  BookBuffer b;
+  b.f = f;
+  assert(b.start = (byte*)malloc(BOOK_BUFFER_SIZE));
+  b.p = b.start;
+
+  // renumber nodes sequentially during the traversal
+  vector<int> number(nodeAllocator->highWater(), NIL);
+  number[0] = 0;
+  int nextAvailable = 1;
+
+  // Depth-first traversal. Stack entries hold a node and its next child.
+  vector<pair<int,int>> stack = { { 0, 0 } };
+  saveNodeHeader(0, &b.p);
+  while (!stack.empty()) {
+    int t = stack.back().first, i = stack.back().second;
+    if (i == node[t].numChildren) {
+      stack.pop_back();
+      continue;
+    }
+    stack.back().second++;
+    flushBookBuffer(&b, false);
 
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
     // Emit the encoded move.
-    u16 x = encodeMove(edge[e].move);
-    fwrite(&x, 2, 1, f);
-
-    // If the child is new, give it a number and call it. Otherwise emit its number.
-    int c = edge[e].node;
-    auto it = map->find(c);
-    if (it == map->end()) {
-      writeVlq(*nextAvailable, f);
-      (*map)[c] = (*nextAvailable)++;
-      saveHelper(c, f, map, nextAvailable);
+    u16 x = encodeMove(child[node[t].child + i].move);
+    memcpy(b.p, &x, 2);
+    b.p += 2;
+
+    // If the child is new, give it a number and descend into it. Otherwise emit its number.
+    int c = child[node[t].child + i].node;
+    if (number[c] == NIL) {
+      number[c] = nextAvailable++;
+      writeVlq(number[c], &b.p);
+      saveNodeHeader(c, &b.p);
+      stack.push_back({ c, 0 });
     } else {
-      writeVlq(it->second, f);
+      writeVlq(number[c], &b.p);
     }
   }
+
+  flushBookBuffer(&b, true);
+  free(b.start);
 }
 
-void Pns::save() {
-  verifyConsistencyWrapper();
+/* Pads f with zeroes up to the given offset. */
+void padTo(FILE* f, u64 offset) {
+  while ((u64)ftell(f) < offset) {
+    fputc(0, f);
+  }
+}
 
-  FILE *f = fopen(bookFileName.c_str(), "w");
-  fwrite(&board, sizeof(Board), 1, f);
+/* Rounds up a book image offset so that sections are page-aligned. */
+u64 alignOffset(u64 offset) {
+  return (offset + BOOK_IMAGE_ALIGN - 1) / BOOK_IMAGE_ALIGN * BOOK_IMAGE_ALIGN;
+}
 
-  // renumber nodes sequentially during the traversal
-  unordered_map<int,int> map;
-  map[0] = 0;
-  int nextAvailable = 1;
-  saveHelper(0, f, &map, &nextAvailable);
+void Pns::saveImage(FILE* f) {
+  // Renumber the nodes in BFS order and count the links.
+  vector<int> newIndex(nodeAllocator->highWater(), NIL);
+  vector<int> order = { 0 };
+  newIndex[0] = 0;
+  u64 numChildren = 0, numEdges = 0;
+  for (unsigned k = 0; k < order.size(); k++) {
+    int t = order[k];
+    for (int i = node[t].child; i < node[t].child + node[t].numChildren; i++) {
+      int c = child[i].node;
+      if (newIndex[c] == NIL) {
+        newIndex[c] = order.size();
+        order.push_back(c);
+      }
+    }
+    numChildren += node[t].numChildren;
+    for (int e = node[t].parent; e != NIL; e = edge[e].next) {
+      numEdges++;
+    }
+  }
+
+  BookImageHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BOOK_IMAGE_MAGIC, sizeof(h.magic));
+  h.nodeSize = sizeof(PnsNode);
+  h.childSize = sizeof(PnsChild);
+  h.edgeSize = sizeof(PnsNodeList);
+  h.transEntrySize = sizeof(TransEntry);
+  h.board = board;
+  h.numNodes = order.size();
+  h.numChildren = numChildren;
+  h.numEdges = numEdges;
+  h.nodeOffset = alignOffset(sizeof(h));
+  h.childOffset = alignOffset(h.nodeOffset + h.numNodes * sizeof(PnsNode));
+  h.edgeOffset = alignOffset(h.childOffset + numChildren * sizeof(PnsChild));
+  h.transOffset = alignOffset(h.edgeOffset + numEdges * sizeof(PnsNodeList));
+  fwrite(&h, sizeof(h), 1, f);
+
+  // Nodes. Child blocks and parent lists are laid out in node order.
+  padTo(f, h.nodeOffset);
+  int childPos = 0, edgePos = 0;
+  for (int t: order) {
+    PnsNode n = node[t];
+    n.child = n.numChildren ? childPos : NIL;
+    childPos += n.numChildren;
+    n.parent = (n.parent == NIL) ? NIL : edgePos;
+    for (int e = node[t].parent; e != NIL; e = edge[e].next) {
+      edgePos++;
+    }
+    fwrite(&n, sizeof(PnsNode), 1, f);
+  }
+
+  padTo(f, h.childOffset);
+  for (int t: order) {
+    for (int i = node[t].child; i < node[t].child + node[t].numChildren; i++) {
+      PnsChild c = { child[i].move, newIndex[child[i].node] };
+      fwrite(&c, sizeof(PnsChild), 1, f);
+    }
+  }
+
+  padTo(f, h.edgeOffset);
+  edgePos = 0;
+  for (int t: order) {
+    for (int e = node[t].parent; e != NIL; e = edge[e].next) {
+      edgePos++;
+      PnsNodeList l = { newIndex[edge[e].node], (edge[e].next == NIL) ? NIL : edgePos };
+      fwrite(&l, sizeof(PnsNodeList), 1, f);
+    }
+  }
+
+  // Rebuild the transposition table with the new numbers. Clones whose
+  // originals are gone have no entries, as in the live tree.
+  TransTable tt(order.size());
+  for (unsigned k = 0; k < order.size(); k++) {
+    int t = order[k];
+    TransEntry *te = trans->find(node[t].zobrist);
+    if (te && (te->orig == t || te->clone == t)) {
+      TransEntry *ne = tt.find(node[t].zobrist);
+      if (!ne) {
+        ne = tt.insert(node[t].zobrist, NIL, NIL);
+      }
+      if (te->orig == t) {
+        ne->orig = k;
+      } else {
+        ne->clone = k;
+      }
+    }
+  }
+  padTo(f, h.transOffset);
+  tt.write(f);
+}
+
+void Pns::writeBook() {
+  verifyTree();
+
+  // Write to a temporary file and rename it, since the book may be mapped.
+  string tmpName = bookFileName + ".tmp";
+  FILE *f = fopen(tmpName.c_str(), "w");
+  if (imageBook) {
+    saveImage(f);
+  } else {
+    fwrite(&board, sizeof(Board), 1, f);
+    saveHelper(f);
+  }
+  // The book must reach the disk before the journal is deleted.
+  fflush(f);
+  fdatasync(fileno(f));
   fclose(f);
+  rename(tmpName.c_str(), bookFileName.c_str());
+}
+
+void Pns::save() {
+  waitForBackgroundSave(true);
+  writeBook();
+  touched.clear();
+
+  // The book now includes everything the journals recorded.
+  if (journal) {
+    fclose(journal);
+    journal = NULL;
+  }
+  unlink((bookFileName + ".journal.old").c_str());
+  unlink((bookFileName + ".journal").c_str());
   log(LOG_INFO, "Saved tree to %s.", bookFileName.c_str());
+  saveEgtbHeat();
 }
 
-void Pns::loadHelper(Board *b, FILE* f) {
-  u64 z = getZobrist(b); // TODO update incrementally from parent to child
-  int t = allocateLeaf(INFTY64, 0, 0, z);
+void Pns::saveInBackground() {
+  if (!waitForBackgroundSave(false)) {
+    log(LOG_INFO, "Previous background save is still running, skipping this one.");
+    return;
+  }
 
-  // Read the number of children and the depth.
-  byte numChildren;
-  fread(&numChildren, 1, 1, f);
-  node[t].depth = readVlq(f);
-
-  auto it = trans.find(z);
-  if (it == trans.end()) {
-    // first time loading this position
-    trans[z] = { t, NIL };
+  // A leftover old journal means that an earlier save failed or was
+  // interrupted. Don't overwrite it.
+  string journalName = bookFileName + ".journal", oldName = journalName + ".old";
+  if (fileExists(oldName.c_str())) {
+    save();
+    return;
+  }
+
+  // The snapshot will include everything recorded so far. Expansions from
+  // now on go to a new journal.
+  if (journal) {
+    fclose(journal);
+    journal = NULL;
+  }
+  rename(journalName.c_str(), oldName.c_str());
+
+  // The child gets a copy-on-write view of the tree as of now. Another thread
+  // could hold the log lock, so the child logs through write(2). It must not
+  // flush our stdio buffers either.
+  pid_t pid = fork();
+  if (pid == -1) {
+    log(LOG_WARNING, "Cannot fork for background save, saving in the foreground.");
+    save();
+  } else if (pid == 0) {
+    logForked();
+    writeBook();
+    unlink(oldName.c_str());
+    _exit(0);
   } else {
-    // other node was loaded; figure out if we are the clone
-    int other = it->second.first;
-    assert(other != t);
-    assert(it->second.second == NIL); // at most two nodes per Zobrist key
-    assert(node[other].depth != node[t].depth); // otherwise they would be one and the same
-
-    if (node[other].depth < node[t].depth) {
-      // lower-depth node always goes first
-      it->second.second = t;
+    savePid = pid;
+    saveTimer.reset();
+    touched.clear(); // the child verifies them
+    saveEgtbHeat();
+  }
+}
+
+bool Pns::waitForBackgroundSave(bool block) {
+  if (!savePid) {
+    return true;
+  }
+  int status;
+  u64 timeout = (u64)cfgBackgroundSaveTimeout * 1000;
+  while (!waitpid(savePid, &status, WNOHANG)) {
+    if (saveTimer.get() > timeout) {
+      log(LOG_WARNING, "Background save to %s is taking too long, killing it.",
+          bookFileName.c_str());
+      kill(savePid, SIGKILL);
+      waitpid(savePid, &status, 0);
+      break;
+    } else if (block) {
+      usleep(100000);
     } else {
-      it->second.first = t;
-      it->second.second = other;
+      return false;
     }
-    assert(it->second.first != it->second.second);
   }
+  savePid = 0;
+  if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+    log(LOG_INFO, "Saved tree to %s in the background.", bookFileName.c_str());
+  } else {
+    log(LOG_WARNING, "Background save to %s failed.", bookFileName.c_str());
+  }
+  return true;
+}
+
+void Pns::convert(string fileName) {
+  imageBook = !imageBook;
+  bookFileName = fileName;
+  save();
+}
+
+int Pns::loadNode(u64 z, byte** p) {
+  int t = allocateLeaf(INFTY64, 0, 0, z);
+
+  // Read the number of children and the depth.
+  byte numChildren = *(*p)++;
+  node[t].depth = readVlq(p);
 
   // For leaves, read and decode the proof / disproof numbers.
   if (!numChildren) {
-    node[t].proof = readVlq(f);
-    node[t].proof = (node[t].proof == 0) ? INFTY64 : (node[t].proof - 1);
-    node[t].disproof = readVlq(f);
-    node[t].disproof = (node[t].disproof == 0) ? INFTY64 : (node[t].disproof - 1);
+    node[t].proof = decodePn(readVlq(p));
+    node[t].disproof = decodePn(readVlq(p));
+  }
+
+  // Reserve the child block now. Children are filled in as they are loaded.
+  if (numChildren && !allocateChildren(t, numChildren)) {
+    die("Child pool too small to load the book, increase pn2Memory.");
+  }
+  return t;
+}
+
+/* Argument of Pns::indexRegionThread(). */
+typedef struct {
+  Pns *pns;
+  u64 start, end;       // slot range
+  int numInserted;
+  vector<int> deferred; // nodes whose keys probe past end
+} IndexRegionArg;
+
+void* Pns::indexRegionThread(void *arg) {
+  IndexRegionArg *r = (IndexRegionArg*)arg;
+  r->numInserted = r->pns->indexRegion(r->start, r->end, &r->deferred);
+  return NULL;
+}
+
+void Pns::indexLoadedNodes() {
+  assert(trans->reserve(nodeAllocator->used(), NULL));
+
+  // Each thread fills its own range of slots. The keys that would probe past
+  // the end of their range are inserted afterwards, one at a time.
+  int n = MAX(cfgPn2Threads, 1);
+  u64 numSlots = trans->capacity();
+  vector<IndexRegionArg> region(n);
+  pthread_t thread[n];
+  bool started[n];
+  for (int i = 0; i < n; i++) {
+    region[i].pns = this;
+    region[i].start = numSlots * i / n;
+    region[i].end = numSlots * (i + 1) / n;
+    started[i] = (i > 0) && !pthread_create(&thread[i], NULL, indexRegionThread, &region[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    if (started[i]) {
+      pthread_join(thread[i], NULL);
+    } else {
+      indexRegionThread(&region[i]);
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    trans->addCount(region[i].numInserted);
+  }
+  for (int i = 0; i < n; i++) {
+    for (int t: region[i].deferred) {
+      u64 z = node[t].zobrist;
+      TransEntry *te = trans->find(z);
+      if (!te) {
+        trans->insert(z, t, NIL);
+      } else {
+        pairLoadedNode(te, t);
+      }
+    }
+  }
+}
+
+int Pns::indexRegion(u64 start, u64 end, vector<int> *deferred) {
+  int numInserted = 0;
+  for (int t = 0; t < nodeAllocator->used(); t++) {
+    u64 z = node[t].zobrist;
+    u64 home = trans->home(z);
+    if ((home >= start) && (home < end)) {
+      bool inserted;
+      TransEntry *te = trans->findOrInsertBefore(z, t, end, &inserted);
+      if (!te) {
+        // All the nodes with this key end up here, since it never fits.
+        deferred->push_back(t);
+      } else if (inserted) {
+        numInserted++;
+      } else {
+        pairLoadedNode(te, t);
+      }
+    }
   }
+  return numInserted;
+}
+
+void Pns::pairLoadedNode(TransEntry *te, int t) {
+  // other node was loaded; figure out if we are the clone
+  int other = te->orig;
+  assert(other != t);
+  assert(te->clone == NIL); // at most two nodes per Zobrist key
+  assert(node[other].depth != node[t].depth); // otherwise they would be one and the same
+
+  if (node[other].depth < node[t].depth) {
+    // lower-depth node always goes first
+    te->clone = t;
+  } else {
+    te->orig = t;
+    te->clone = other;
+  }
+  assert(te->orig != te->clone);
+}
+
+void Pns::loadChildLink(int t, int i) {
+  int c = child[node[t].child + i].node;
+  addParent(c, t);
+
+  node[t].proof = MIN(node[t].proof, node[c].disproof);
+  node[t].disproof = MIN(node[t].disproof + node[c].proof, INFTY64);
+}
+
+void Pns::loadHelper(FILE* f) {
+  BookBuffer b;
+  b.f = f;
+  assert(b.start = (byte*)malloc(BOOK_BUFFER_SIZE));
+  b.p = b.end = b.start;
+  fillBookBuffer(&b);
+
+  // Depth-first traversal mirroring saveHelper(). Leaves are never pushed.
+  vector<BookLoadFrame> stack;
+  BookLoadFrame root = { 0, 0, getZobrist(&board), board };
+  root.t = loadNode(root.z, &b.p);
+  stack.push_back(root);
+
+  while (!stack.empty()) {
+    BookLoadFrame *fr = &stack.back();
+    int t = fr->t;
+    if (fr->i == node[t].numChildren) {
+      // All the children are loaded; now we can link t to its parent.
+      stack.pop_back();
+      if (!stack.empty()) {
+        loadChildLink(stack.back().t, stack.back().i - 1);
+      }
+      continue;
+    }
+    fillBookBuffer(&b);
 
-  int tail = NIL;
-  Board b2;
-  while (numChildren--) {
     u16 encodedMove;
-    fread(&encodedMove, 2, 1, f);
+    memcpy(&encodedMove, b.p, 2);
+    b.p += 2;
     Move m = decodeMove(encodedMove);
-    int c = readVlq(f);
+    int c = readVlq(&b.p);
     assert(c <= nodeAllocator->used());
+    child[node[t].child + fr->i++] = { m, c };
+
     if (c == nodeAllocator->used()) {
-      b2 = *b;
-      makeMove(&b2, m);
-      loadHelper(&b2, f); // this will load node c
+      // Compute the child's key from ours. Only make the move if the child
+      // has children of its own.
+      u64 z = updateZobrist(fr->z, &fr->b, m);
+      loadNode(z, &b.p); // this will load node c
+      if (node[c].numChildren) {
+        BookLoadFrame next = { c, 0, z, fr->b };
+        makeMove(&next.b, m);
+        stack.push_back(next);
+        continue;
+      }
     }
-
-    tail = appendChild(t, c, m, tail);
-    addParent(c, t);
-
-    node[t].proof = MIN(node[t].proof, node[c].disproof);
-    node[t].disproof = MIN(node[t].disproof + node[c].proof, INFTY64);
+    loadChildLink(t, fr->i - 1);
   }
+
+  free(b.start);
+  indexLoadedNodes();
 }
 
 void Pns::load() {
   FILE *f = fopen(bookFileName.c_str(), "r");
+  mpnPath.clear();
 
   if (!f) {
     log(LOG_WARNING, "Cannot read input file [%s]. Starting with an empty tree.",
@@ -748,13 +1618,177 @@ void Pns::load() {
     return;
   }
 
+  char magic[sizeof(BOOK_IMAGE_MAGIC)];
+  if ((fread(magic, 1, sizeof(magic), f) == sizeof(magic)) &&
+      !memcmp(magic, BOOK_IMAGE_MAGIC, sizeof(magic))) {
+    fclose(f);
+    u64 size;
+    char *data = mapFilePrivate(bookFileName.c_str(), &size);
+    if (!data) {
+      die("Cannot map book image %s.", bookFileName.c_str());
+    }
+    loadImage(data);
+    imageBook = true;
+    log(LOG_INFO, "Mapped tree from %s, %d nodes, %llu MB.",
+        bookFileName.c_str(), nodeAllocator->used(), size >> 20);
+    replayJournals();
+    // Note that a full check reads the whole file.
+    verifyTree();
+    return;
+  }
+  rewind(f);
+
   assert(fread(&board, sizeof(Board), 1, f) == 1);
-  loadHelper(&board, f);
+  loadHelper(f);
 
   fclose(f);
-  log(LOG_INFO, "Loaded tree from %s, %d nodes.",
-      bookFileName.c_str(), nodeAllocator->used());
-  verifyConsistencyWrapper();
+  log(LOG_INFO, "Loaded tree from %s, %d nodes, %llu MB.",
+      bookFileName.c_str(), nodeAllocator->used(), memoryUsage() >> 20);
+  replayJournals();
+  verifyTree();
+}
+
+void Pns::loadImage(char* data) {
+  BookImageHeader *h = (BookImageHeader*)data;
+  if ((h->nodeSize != sizeof(PnsNode)) ||
+      (h->childSize != sizeof(PnsChild)) ||
+      (h->edgeSize != sizeof(PnsNodeList)) ||
+      (h->transEntrySize != sizeof(TransEntry))) {
+    die("Book image %s was saved with a different memory layout. "
+        "Convert it with the build that saved it.", bookFileName.c_str());
+  }
+  board = h->board;
+  nodeAllocator->adopt(data + h->nodeOffset, h->numNodes);
+  childAllocator->adopt(data + h->childOffset, h->numChildren);
+  edgeAllocator->adopt(data + h->edgeOffset, h->numEdges);
+  trans->adopt(data + h->transOffset);
+}
+
+void Pns::journalExpansion(int t, Board *b) {
+  if (!pn1 || bookFileName.empty() || (cfgJournalSyncEvery <= 0)) {
+    return;
+  }
+  if (!journal) {
+    string fileName = bookFileName + ".journal";
+    if (!(journal = fopen(fileName.c_str(), "a"))) {
+      die("Cannot open journal file %s.", fileName.c_str());
+    }
+  }
+
+  // Record the board and which of the position's nodes t is. Then record
+  // either t's children, with the numbers PN1 gave them, or t's score.
+  byte buf[JOURNAL_MAX_RECORD], *p = buf + sizeof(u32);
+  TransEntry *te = trans->find(node[t].zobrist);
+  memcpy(p, b, sizeof(Board));
+  p += sizeof(Board);
+  *p++ = (te->clone == t);
+  *p++ = node[t].numChildren;
+  if (!node[t].numChildren) {
+    writeVlq(encodePn(node[t].proof), &p);
+    writeVlq(encodePn(node[t].disproof), &p);
+  }
+  for (int i = 0; i < node[t].numChildren; i++) {
+    u16 x = encodeMove(move[i]);
+    memcpy(p, &x, 2);
+    p += 2;
+    writeVlq(encodePn(proof[i]), &p);
+    writeVlq(encodePn(disproof[i]), &p);
+  }
+
+  // Prefix the record with its length, so that a torn write can be detected.
+  u32 len = p - buf - sizeof(u32);
+  memcpy(buf, &len, sizeof(u32));
+  fwrite(buf, 1, p - buf, journal);
+}
+
+void Pns::syncJournal() {
+  if (journal) {
+    fflush(journal);
+    fdatasync(fileno(journal));
+  }
+}
+
+bool Pns::replayExpansion(byte* p) {
+  Board b;
+  memcpy(&b, p, sizeof(Board));
+  p += sizeof(Board);
+  bool isClone = *p++;
+  int nc = *p++;
+
+  // Find the node. It should be an unexpanded leaf, unless the book was saved
+  // after this record was written.
+  TransEntry *te = trans->find(getZobrist(&b));
+  int t = !te ? NIL : isClone ? te->clone : te->orig;
+  if ((t == NIL) || node[t].numChildren || isSolved(t) || isDrawn(t)) {
+    return false;
+  }
+
+  if (!nc) {
+    node[t].proof = decodePn(readVlq(&p));
+    node[t].disproof = decodePn(readVlq(&p));
+  } else {
+    for (int i = 0; i < nc; i++) {
+      u16 x;
+      memcpy(&x, p, 2);
+      p += 2;
+      move[i] = decodeMove(x);
+      proof[i] = decodePn(readVlq(&p));
+      disproof[i] = decodePn(readVlq(&p));
+    }
+    if (!addChildren(t, &b, move, nc)) {
+      return false;
+    }
+  }
+
+  // From here on, proceed exactly like analyzeSubtree().
+  clearSeen();
+  update(t);
+  updateChildDepths(t);
+  markTouched(t);
+  return true;
+}
+
+void Pns::replayJournals() {
+  // An old journal is left over from an unfinished background save.
+  replayJournal(bookFileName + ".journal.old");
+  replayJournal(bookFileName + ".journal");
+}
+
+void Pns::replayJournal(string fileName) {
+  FILE *f = fopen(fileName.c_str(), "r");
+  if (!f) {
+    return;
+  }
+
+  byte buf[JOURNAL_MAX_RECORD];
+  u32 len;
+  int numReplayed = 0, numSkipped = 0;
+  long end = 0; // end of the last complete record
+  while ((fread(&len, sizeof(u32), 1, f) == 1) &&
+         (len <= JOURNAL_MAX_RECORD) &&
+         (fread(buf, 1, len, f) == len)) {
+    if (replayExpansion(buf)) {
+      numReplayed++;
+    } else {
+      numSkipped++;
+    }
+    end = ftell(f);
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  log(LOG_INFO, "Replayed %d expansions from %s, skipped %d.",
+      numReplayed, fileName.c_str(), numSkipped);
+
+  // Drop the torn record, if any. Otherwise new records would be appended
+  // after it and its length prefix would swallow them on the next load.
+  if (size > end) {
+    log(LOG_WARNING, "Dropping %ld bytes of incomplete records from %s.",
+        size - end, fileName.c_str());
+    if (truncate(fileName.c_str(), end)) {
+      die("Cannot truncate journal file %s.", fileName.c_str());
+    }
+  }
 }
 
 bool Pns::batchLookup(Board* b, u64* proof, u64* disproof,
@@ -762,13 +1796,16 @@ bool Pns::batchLookup(Board* b, u64* proof, u64* disproof,
                       int* numMoves) {
   *numMoves = 0;
 
+  // Keep the pools from moving under us.
+  pthread_mutex_lock(&poolLock);
   u64 z = getZobrist(b);
-  auto it = trans.find(z);
-  if (it == trans.end()) {
+  TransEntry *te = trans->find(z);
+  if (!te) {
+    pthread_mutex_unlock(&poolLock);
     return false;
   }
-  int t = it->second.first;
-  log(LOG_DEBUG, "query for nodes #%d & #%d, depth %d", t, it->second.second, node[t].depth);
+  int t = te->orig;
+  log(LOG_DEBUG, "query for nodes #%d & #%d, depth %d", t, te->clone, (int)node[t].depth);
 
   // Get the names of all legal moves on b. This may not be equal to the
   // number of t's children, which may have beeen trimmed.
@@ -777,18 +1814,19 @@ bool Pns::batchLookup(Board* b, u64* proof, u64* disproof,
   int n = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, n, names);
 
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
+  for (int j = 0; j < node[t].numChildren; j++) {
+    PnsChild *ch = &child[node[t].child + j];
     // look up this child's move
     int i = 0;
-    while (!equalMove(m[i], edge[e].move)) {
+    while (!equalMove(m[i], ch->move)) {
       i++;
     }
 
     cMoves[*numMoves] = names[i];
 
-    int c = edge[e].node;
+    int c = ch->node;
     Board b2 = *b;
-    makeMove(&b2, edge[e].move);
+    makeMove(&b2, ch->move);
     cFens[*numMoves] = boardToFen(&b2);
 
     cProofs[*numMoves] = node[c].proof;
@@ -797,44 +1835,78 @@ bool Pns::batchLookup(Board* b, u64* proof, u64* disproof,
         c, names[i].c_str(),
         pnAsString(node[c].proof).c_str(),
         pnAsString(node[c].disproof).c_str(),
-        node[c].depth);
+        (int)node[c].depth);
     (*numMoves)++;
   }
 
   *proof = node[t].proof;
   *disproof = node[t].disproof;
+  pthread_mutex_unlock(&poolLock);
   return true;
 }
 
+void Pns::verifyLinks(int t) {
+  assert(nodeAllocator->isInUse(t));
+  int first = node[t].child, end = first + node[t].numChildren;
+
+  // check that our proof is our first child's disproof
+  assert(node[t].proof == node[child[first].node].disproof);
+
+  if (node[t].disproof == 0) {
+    // all our parents should be winning
+    for (int e = node[t].parent; e != NIL; e = edge[e].next) {
+      assert(node[edge[e].node].proof == 0);
+    }
+  }
+
+  for (int e = first; e < end; e++) {
+    int c = child[e].node;
+    assert(isSolved(t) || isSolved(c) || (node[c].depth > node[t].depth));
+
+    // check that the child links back to us
+    int f = node[c].parent;
+    while ((f != NIL) && (edge[f].node != t)) {
+      f = edge[f].next;
+    }
+    assert(f != NIL);
+
+    // check that this child is better than the next one.
+    if (e + 1 < end) {
+      assert(nodeCmp(c, child[e + 1].node) <= 0);
+    }
+  }
+
+  // With trimming enabled, won nodes keep only their winning move.
+  if (trim) {
+    assert((node[t].numChildren == 1) || (node[t].proof > 0));
+  }
+
+  assert(trans->find(node[t].zobrist));
+}
+
 void Pns::verifyConsistency(int t, Board *b, unordered_set<int>* seenNodes,
-                            unordered_set<int>* seenEdges) {
-  if (!seenNodes->insert(t).second) {
-    return; // already visited
+                            unordered_set<int>* seenEdges,
+                            unordered_set<int>* seenChildren, int* budget) {
+  if (!*budget || !seenNodes->insert(t).second) {
+    return; // out of budget or already visited
   }
-  if (node[t].child == NIL) {
+  (*budget)--;
+  if (!node[t].numChildren) {
     return;
   }
-  assert(nodeAllocator->isInUse(t));
+  verifyLinks(t);
 
-  // check that all edge pointers are globally distinct
+  // check that all parent edges are globally distinct and that child blocks
+  // do not overlap
   for (int e = node[t].parent; e != NIL; e = edge[e].next) {
     if (!seenEdges->insert(e).second) {
       die("Edge %d appears twice", e);
     }
   }
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
-    if (!seenEdges->insert(e).second) {
-      die("Edge %d appears twice", e);
-    }
-  }
-
-  // check that our proof is our first child's disproof
-  assert(node[t].proof == node[edge[node[t].child].node].disproof);
-
-  if (node[t].disproof == 0) {
-    // all our parents should be winning
-    for (int e = node[t].parent; e != NIL; e = edge[e].next) {
-      assert(node[edge[e].node].proof == 0);
+  int first = node[t].child, end = first + node[t].numChildren;
+  for (int e = first; e < end; e++) {
+    if (!seenChildren->insert(e).second) {
+      die("Child slot %d appears twice", e);
     }
   }
 
@@ -843,45 +1915,31 @@ void Pns::verifyConsistency(int t, Board *b, unordered_set<int>* seenNodes,
   int nc = getAllMoves(b, m, FORWARD);
   Board bc;
 
-  for (int e = node[t].child; e != NIL; e = edge[e].next) {
-    int c = edge[e].node, i = 0;
-    assert(isSolved(t) || isSolved(c) || (node[c].depth > node[t].depth));
+  for (int e = first; e < end; e++) {
+    int c = child[e].node, i = 0;
 
     // find this move in the legal move list and delete it
-    m[nc] = edge[e].move;
-    while (!equalMove(edge[e].move, m[i])) {
+    m[nc] = child[e].move;
+    while (!equalMove(child[e].move, m[i])) {
       i++;
     }
     if (i == nc) {
       printBoard(b);
-      log(LOG_WARNING, "Illegal move in child list: %s, stored in edge #%d between nodes %d->%d",
-          getLongMoveName(edge[e].move).c_str(), e, t, c);
+      log(LOG_WARNING, "Illegal move in child list: %s, stored in slot #%d between nodes %d->%d",
+          getLongMoveName(child[e].move).c_str(), e, t, c);
       assert(false);
     }
     m[i] = m[--nc];
 
-    // check that the child links back to us
-    int f = node[c].parent;
-    while ((f != NIL) && (edge[f].node != t)) {
-      f = edge[f].next;
-    }
-    assert(f != NIL);
-
-    // check that this child is better than the next one.
-    if (edge[e].next != NIL) {
-      assert(nodeCmp(c, edge[edge[e].next].node) <= 0);
-    }
-
     bc = *b;
-    makeMove(&bc, edge[e].move);
-    verifyConsistency(c, &bc, seenNodes, seenEdges);
+    makeMove(&bc, child[e].move);
+    verifyConsistency(c, &bc, seenNodes, seenEdges, seenChildren, budget);
   }
 
   if (nc) {
     // some moves have been deleted: node should be won and have one losing child
-    assert(node[t].child != NIL);
-    assert(edge[node[t].child].next == NIL);
-    int c = edge[node[t].child].node;
+    assert(node[t].numChildren == 1);
+    int c = child[first].node;
 
     if (node[t].proof) {
       printBoard(b);
@@ -894,20 +1952,76 @@ void Pns::verifyConsistency(int t, Board *b, unordered_set<int>* seenNodes,
     assert(node[t].disproof == INFTY64);
     assert(node[c].proof == INFTY64);
     assert(node[c].disproof == 0);
-  } else {
-    // With trimming enabled, if all moves have a match, than either there is
-    // only one move or no moves are winning.
-    if (trim) {
-      assert((edge[node[t].child].next == NIL) ||
-             (node[t].proof > 0));
-    }
   }
-
-  assert(trans.find(node[t].zobrist) != trans.end());
 }
 
 void Pns::verifyConsistencyWrapper() {
   unordered_set<int> seenNodes;
   unordered_set<int> seenEdges;
-  verifyConsistency(0, &board, &seenNodes, &seenEdges);
+  unordered_set<int> seenChildren;
+  int budget = INFTY;
+  verifyConsistency(0, &board, &seenNodes, &seenEdges, &seenChildren, &budget);
+}
+
+void Pns::verifySampled(int budget) {
+  unordered_set<int> seenNodes;
+  unordered_set<int> seenEdges;
+  unordered_set<int> seenChildren;
+  int sampleSize = max(budget / VERIFY_SAMPLES, 1);
+
+  while (budget > 0) {
+    // Walk down a random path, stopping at each level with probability 1/4.
+    Board b = board;
+    int t = 0;
+    while (node[t].numChildren && (rand() & 3)) {
+      PnsChild *c = &child[node[t].child + rand() % node[t].numChildren];
+      makeMove(&b, c->move);
+      t = c->node;
+    }
+
+    int sampleBudget = MIN(budget, sampleSize);
+    budget -= sampleBudget;
+    verifyConsistency(t, &b, &seenNodes, &seenEdges, &seenChildren, &sampleBudget);
+  }
+}
+
+void Pns::markTouched(int t) {
+  if (pn1 && (cfgVerifyLevel == VERIFY_INCREMENTAL)) {
+    touched.push_back(t);
+  }
+}
+
+void Pns::verifyTouched() {
+  // Check the touched nodes and all their ancestors, whose numbers and child
+  // order may have changed as a result.
+  unordered_set<int> seenNodes;
+  vector<int> stack;
+  stack.swap(touched);
+  while (!stack.empty()) {
+    int t = stack.back();
+    stack.pop_back();
+    // A touched node may have been trimmed since. Its slot may even be reused.
+    if (nodeAllocator->isInUse(t) && seenNodes.insert(t).second) {
+      if (node[t].numChildren) {
+        verifyLinks(t);
+      }
+      for (int e = node[t].parent; e != NIL; e = edge[e].next) {
+        stack.push_back(edge[e].node);
+      }
+    }
+  }
+}
+
+void Pns::verifyTree() {
+  switch (cfgVerifyLevel) {
+    case VERIFY_SAMPLED:
+      verifySampled(cfgVerifySampleNodes);
+      break;
+    case VERIFY_INCREMENTAL:
+      verifyTouched();
+      break;
+    case VERIFY_FULL:
+      verifyConsistencyWrapper();
+      break;
+  }
 }
@@ -1,33 +1,130 @@
 #ifndef PNS_H
 #define PNS_H
 
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <queue>
+#include <vector>
 #include "allocator.h"
+#include "block_allocator.h"
+#include "pn1_searcher.h"
+#include "score_cache.h"
+#include "timer.h"
+#include "trans_table.h"
+#include "worker_pool.h"
 
-/* A PN search tree node (it's really a DAG). Pointers are statically represented in a preallocated memory area. */
+/**
+ * A (dis)proof number stored in 32 bits. Reads and writes as a u64. INFTY64
+ * and INFTY64 - 1 (see Pns::VIRTUAL_PN) map to the two largest values. Larger
+ * finite numbers saturate just below them.
+ */
+typedef struct PnNumber {
+  static const u32 INF = 0xffffffff;
+
+  u32 value;
+
+  operator u64() const {
+    return (value >= INF - 1) ? (INFTY64 - (INF - value)) : value;
+  }
+
+  PnNumber& operator=(u64 x) {
+    value = (x >= INFTY64 - 1) ? (INF - (u32)(INFTY64 - x)) : (u32)MIN(x, INF - 2);
+    return *this;
+  }
+} PnNumber;
+
+/* A node depth stored in 16 bits. Reads and writes as an int, INFTY included. */
+typedef struct NodeDepth {
+  static const u16 INF = 0xffff;
+
+  u16 value;
+
+  operator int() const {
+    return (value == INF) ? INFTY : value;
+  }
+
+  NodeDepth& operator=(int d) {
+    assert((d == INFTY) || (d >= 0 && d < INF));
+    value = (d == INFTY) ? INF : d;
+    return *this;
+  }
+} NodeDepth;
+
+/**
+ * A PN search tree node (it's really a DAG). Pointers are statically
+ * represented in a preallocated memory area. Packed to 28 bytes, since node[]
+ * is the largest array in PN2.
+ */
+#pragma pack(push, 4)
 typedef struct {
-  u64 proof;
-  u64 disproof;
-  u64 zobrist;       // zobrist key of the position (0 if the node is a repetition)
-  int child, parent; // pointers to heads of child and parent lists
-  int depth;         // minimum depth from root on any path
+  u64 zobrist;         // zobrist key of the position
+  PnNumber proof;
+  PnNumber disproof;
+  int child;           // start of the child block in child[], or NIL
+  int parent;          // pointer to the head of the parent list
+  NodeDepth depth;     // minimum depth from root on any path
+  byte numChildren;    // size of the child block
 } PnsNode;
+#pragma pack(pop)
 
 /**
- * A linked list of PnsNodes. For each node, store the move that takes us
- * there. The move field is used for child lists, but not for parent lists.
+ * A child of a PnsNode, along with the move that takes us there. The
+ * children of each node are stored consecutively in child[] and kept sorted
+ * by (dis)proof, best first.
  */
 typedef struct {
   Move move;
   int node;
+} PnsChild;
+
+/* A linked list of PnsNodes. Used for parent lists. */
+typedef struct {
+  int node;
   int next;
 } PnsNodeList;
 
+/**
+ * A leaf selected for expansion along with other leaves. It is hidden from
+ * further selections with VIRTUAL_PN (dis)proof numbers until it is expanded.
+ * See Pns::selectLeaves().
+ */
+typedef struct {
+  int node;
+  Board board;          // position at node
+  u64 zobrist;          // zobrist key of the position
+  u64 proof, disproof;  // real (dis)proof numbers of node
+  int score;            // PN1 only: EGTB score or EGTB_UNKNOWN
+  int numMoves;         // PN1 only: number of legal moves, if score is unknown
+  Move move[MAX_MOVES];
+} PnsLeaf;
+
+/**
+ * A node on the path to the last MPN, along with its position. See
+ * Pns::selectMpn().
+ */
+typedef struct {
+  int node;
+  Board board;
+  int movesLength; // length of the move names leading here, for logging
+} PnsPathStep;
+
 /*
  * Class that handles proof-number search.
  */
-class Pns {
+class Pns : public Pn1Searcher {
+  /* Pools never grow beyond this, so that indices stay below NIL. */
+  static const int MAX_POOL_SIZE = NIL - 1;
+
+  /* Initial number of keys in the transposition table, unless maxNodes is lower. */
+  static const int INITIAL_TRANS_SIZE = 1 << 16;
+
   Allocator* nodeAllocator;
   Allocator* edgeAllocator;
+  BlockAllocator* childAllocator;
+
+  /* Memory cap for the tree in bytes, or 0 if only the node count is capped. */
+  u64 maxMemory;
 
   // temporary space for move generation and for values copied from PN1
   Move move[MAX_MOVES];
@@ -37,7 +134,7 @@ class Pns {
    * Maps Zobrist keys to pairs of indices in node[]. Each position can occur
    * twice in the DAG: once for transpositions, with (dis)proof numbers
    * computed as usually, and once for repetitions, with (dis)proof numbers
-   * set to inf/inf initially. These are stored first and second in the pair,
+   * set to inf/inf initially. These are stored as orig and clone,
    * respectively. If the first node is eventually solved, we mark the second
    * one as solved as well and run update() from it once.
    *
@@ -45,15 +142,103 @@ class Pns {
    * 5.4. Unlike Schijf, we don't store an ancestor hash table. Instead we
    * rely on node minimum depths.
    */
-  unordered_map<u64, pair<int,int>> trans;
+  TransTable* trans;
 
-  /* Set of nodes visiting during a trim operation, for preventing reentry. */
-  unordered_set<int> seen;
+  /**
+   * Held by the pools while their arrays move and by batchLookup(), which
+   * the query server calls from its own thread.
+   */
+  pthread_mutex_t poolLock;
 
-  /* First level PN tree, if we are a second level PN tree. */
-  Pns* pn1;
+  /**
+   * Path from the start node to the last MPN and the names of the moves
+   * along it (PN2 only). The next selection resumes from the deepest node on
+   * the path that is still reached through first children.
+   */
+  vector<PnsPathStep> mpnPath;
+  string mpnMoves;
+
+  /**
+   * One word per node, outside PnsNode so that books are unaffected. The low
+   * bits hold the generation in which a trim last visited the node; trims
+   * never delete a node twice in the same generation. The high bit is set
+   * while the node waits in updateQueue. Generations are wide enough that
+   * wrapping around, which requires a pass over all stamps, is rare.
+   */
+  vector<u32> stamp;
+  u32 seenGeneration;
+  static const u32 QUEUED = 0x80000000;
+
+  /**
+   * Nodes waiting for update(), deepest first, so that each node is
+   * normally recomputed once, after all its changed descendants.
+   */
+  priority_queue<pair<int, int>> updateQueue;
+
+  /**
+   * For each queued node, the child that changed and caused it to be queued,
+   * or NIL if the node changed itself or several children changed.
+   */
+  vector<int> changedChild;
+
+  /* First level searcher, if we are a second level PN tree. */
+  Pn1Searcher* pn1;
+
+  /**
+   * PN1 searchers for parallel analysis, starting with pn1, one per thread.
+   * See expandParallel().
+   */
+  vector<Pn1Searcher*> pn1Workers;
+
+  /* Runs pn1Workers in parallel. NULL unless there are several. */
+  WorkerPool *pn1Pool;
+
+  /* Boards for pn1Workers to search in this round. See expandParallel(). */
+  vector<Board*> pn1Boards;
+
+  /**
+   * Runs searchThread() on pn1Threads threads, all of which descend this PN1
+   * tree. NULL in PN2 or with a single PN1 thread. See searchParallel().
+   */
+  WorkerPool *searchPool;
+
+  /**
+   * Guards the tree during a tree-parallel PN1 search. Descents hold it for
+   * reading, so that they run concurrently. Expansions and the updates after
+   * them hold it for writing.
+   */
+  pthread_rwlock_t treeLock;
+
+  /**
+   * For each node, the number of threads whose selected path goes through
+   * it. Counts the node as worse than its siblings during a descent. Changed
+   * with atomic operations under either hold of treeLock. See selectShared().
+   */
+  vector<u32> busy;
+
+  /* Root, board and memory status of the current tree-parallel search. */
+  int searchStart;
+  Board searchBoard;
+  bool searchFull;
+
+  /**
+   * (Dis)proof number temporarily given to MPNs that are being expanded in
+   * parallel. It makes them look almost drawn, so that their ancestors become
+   * unattractive and the next selection takes a different path.
+   */
+  static const u64 VIRTUAL_PN = INFTY64 - 1;
 
   int numEgtbLookups;
+
+  /* Caches EGTB scores by Zobrist key across PN1 runs. NULL in PN2. */
+  ScoreCache* probeCache;
+
+  /**
+   * Caches positions that PN1 has proven won (1) or lost (-1) across PN1
+   * runs. PN1 scores cached positions without expanding them, like EGTB
+   * positions. NULL in PN2.
+   */
+  ScoreCache* solvedCache;
   bool trim; // whether or not non-winning edges should be trimmed
 
   /**
@@ -61,10 +246,35 @@ class Pns {
    */
   string bookFileName;
 
+  /* True iff the book is saved as an image rather than in VLQ format. */
+  bool imageBook;
+
+  /**
+   * Journal of expansions made since the book was last saved, or NULL if
+   * nothing was expanded yet. See journalExpansion().
+   */
+  FILE* journal;
+
+  /**
+   * Nodes expanded since the last checkpoint, when verifying incrementally.
+   * See verifyTouched().
+   */
+  vector<int> touched;
+
+  /* Number of subtrees checked by verifySampled(). */
+  static const int VERIFY_SAMPLES = 16;
+
+  /* Process writing a snapshot of the tree, or 0. See saveInBackground(). */
+  pid_t savePid;
+
+  /* Time since savePid was started. */
+  Timer saveTimer;
+
 public:
 
-  /* Preallocated arrays of nodes and edges. */
+  /* Preallocated arrays of nodes, child blocks and parent edges. */
   PnsNode *node;
+  PnsChild *child;
   PnsNodeList *edge;
 
   /**
@@ -76,16 +286,21 @@ public:
   /**
    * Creates a level-1 PNS DAG with the given size limits.
    */
-  Pns(int nodes, int edges) : Pns(nodes, edges, NULL, "") { }
+  Pns(int maxNodes, int maxMemory) : Pns(maxNodes, maxMemory, NULL, "") { }
+
+  /* Stops the worker threads, if any. */
+  ~Pns();
 
   /**
-   * Creates a level-2 PNS DAG with the given size limits.
-   * @param nodes Maximum number of nodes.
-   * @param edges Maximum number of edges.
+   * Creates a level-2 PNS DAG with the given size limits. Memory is allocated
+   * on demand, up to the limits.
+   * @param maxNodes Maximum number of nodes.
+   * @param maxMemory Maximum memory for nodes, edges and the transposition
+   * table, in MB, or 0 for no limit other than maxNodes.
    * @param pn1 Pointer to the level-1 analyzer.
    * @param bookFileName File to  save/load from.
    */
-  Pns(int nodes, int edges, Pns* pn1, string bookFileName);
+  Pns(int maxNodes, int maxMemory, Pn1Searcher* pn1, string bookFileName);
 
   /**
    * Continues expanding the tree until the root is solved or memory is
@@ -117,6 +332,15 @@ public:
   /* Returns the root's disproof number. */
   u64 getDisproof();
 
+  /* Analyzes b from scratch as a PN1 tree. */
+  void search(Board *b);
+
+  /* Copies the root's moves and the (dis)proof numbers of its children. */
+  int getChildren(Move *m, u64 *proof, u64 *disproof);
+
+  /* Creates a PN1 tree sized like this one, sharing its caches. */
+  Pn1Searcher* newWorker();
+
   /* Clears all the information from the tree. */
   void reset();
 
@@ -126,16 +350,35 @@ public:
    */
   void collapse();
 
-  /* Saves the PNS tree. */
+  /**
+   * Saves the PNS tree and deletes its journals, which the book now includes.
+   * Waits for any background save to finish first.
+   */
   void save();
 
+  /**
+   * Saves the PNS tree from a forked child process, so that the analysis can
+   * continue meanwhile. The current journal becomes <book>.journal.old and
+   * the child deletes it once the book is written. The EGTB heat is saved
+   * right away, from this process. Skips this save if the previous one is
+   * still running.
+   */
+  void saveInBackground();
+
   /**
    * Loads a PN^2 tree from the file and sets rootBoard to the board contained
    * therein. If the file does not exist, then creates a 1-node tree and sets
-   * rootBoard to the initial position.
+   * rootBoard to the initial position. Book images are mapped rather than
+   * parsed, see saveImage(). Then replays the journal, if there is one.
    */
   void load();
 
+  /* Saves the tree to fileName in the other book format (VLQ or image). */
+  void convert(string fileName);
+
+  /* Flushes the journal to disk, if it is open. */
+  void syncJournal();
+
   /**
    * Fills the arrays with information about the node and its children.
    * Returns true iff the position is known. To be used by the query server.
@@ -158,6 +401,16 @@ private:
    */
   string pnAsString(u64 number);
 
+  /* Returns the memory allocated for the tree, in bytes. */
+  u64 memoryUsage();
+
+  /**
+   * Returns true iff the tree is too close to its size limits to accommodate
+   * another expansion. Otherwise, the pools have already grown enough for
+   * it.
+   */
+  bool isFull();
+
   /**
    * Creates a PNS tree node with no children or parents and given (dis)proof
    * numbers. Returns its index in the preallocated array.
@@ -169,29 +422,123 @@ private:
   void addParent(int childIndex, int parentIndex);
 
   /**
-   * Prepends a node to a parent's child list. Resorts the list.
+   * Allocates a child block of the given size for t. The caller must fill it
+   * in.
+   * @return False if there is no free block of that size.
    */
-  void prependChild(int parentIndex, int childIndex, Move m);
+  bool allocateChildren(int t, int size);
 
-  /**
-   * Appends a node to a parent's child list.
-   * @param tail A pointer to the last element, or NIL if parentIndex has no children.
-   * @return The new tail element.
-   */
-  int appendChild(int parentIndex, int childIndex, Move m, int tail);
+  /* Frees t's child block. Does not touch the children's parent lists. */
+  void freeChildren(int t);
 
   /* Prints a PNS tree node recursively. */
   void printTree(int t, int level, int maxLevels);
 
+  /* Encodes t's number of children, depth and, for leaves, proof and disproof numbers at *p. */
+  void saveNodeHeader(int t, byte** p);
+
+  /**
+   * Saves the tree to f in VLQ format, in depth-first order. Nodes are
+   * numbered in the order they are first visited.
+   */
+  void saveHelper(FILE* f);
+
   /**
-   * Saves a node in the PNS tree.
+   * Allocates a node with Zobrist key z and decodes its header from *p.
+   * Reserves, but does not fill in, its child block.
+   * @return The new node's index.
    */
-  void saveHelper(int t, FILE* f, unordered_map<int,int>* map, int* nextAvailable);
+  int loadNode(u64 z, byte** p);
 
   /**
-   * Loads a node in the PNS tree.
+   * Adds all the loaded nodes to the transposition table. When two nodes
+   * share a key, the lower-depth one becomes the original. Uses cfgPn2Threads
+   * threads, each of which fills one range of slots. See indexRegion().
    */
-  void loadHelper(Board *b, FILE* f);
+  void indexLoadedNodes();
+
+  /**
+   * Indexes the loaded nodes whose keys have their home slots between start
+   * and end - 1, without probing past end. Adds the others that have to go
+   * further to deferred.
+   * @return The number of keys added.
+   */
+  int indexRegion(u64 start, u64 end, vector<int> *deferred);
+
+  /* Thread entry point for indexRegion(). */
+  static void* indexRegionThread(void *arg);
+
+  /* Makes t the original or the clone of te, the entry of another loaded node. */
+  void pairLoadedNode(TransEntry *te, int t);
+
+  /* Links t to its i-th child, which is fully loaded, and updates t's proof and disproof numbers. */
+  void loadChildLink(int t, int i);
+
+  /**
+   * Loads a tree in VLQ format from f, which must be positioned just after
+   * the board.
+   */
+  void loadHelper(FILE* f);
+
+  /**
+   * Appends t's expansion to the journal, opening it if needed. Records are
+   * logical: the board, whether t is the position's clone, and either PN1's
+   * moves and (dis)proof numbers or t's score if it got no children. Replaying
+   * the expansion recomputes every other change, including trims.
+   * Does nothing in PN1 or if the journal is disabled.
+   */
+  void journalExpansion(int t, Board *b);
+
+  /**
+   * Replays one journal record.
+   * @return False if the record cannot be applied because its node no longer
+   * is an unexpanded leaf, or if the tree is full.
+   */
+  bool replayExpansion(byte* p);
+
+  /**
+   * Replays a journal file, if it exists. Stops at the first incomplete
+   * record and truncates the file there, so that new records can follow.
+   */
+  void replayJournal(string fileName);
+
+  /* Replays the book's old journal, then its current journal. */
+  void replayJournals();
+
+  /**
+   * Verifies the tree and writes it to the book file. In a forked child,
+   * call logForked() first.
+   */
+  void writeBook();
+
+  /**
+   * Reaps the background save process, if any, and logs its outcome. Kills
+   * the process if it runs for longer than cfgBackgroundSaveTimeout seconds.
+   * @param block If true, waits for the process to finish.
+   * @return False if the process is still running.
+   */
+  bool waitForBackgroundSave(bool block);
+
+  /**
+   * Saves the tree as a book image: a header followed by the node, child and
+   * parent edge arrays and the transposition table, exactly as they are laid
+   * out in memory. Nodes are renumbered so that the arrays have no holes.
+   */
+  void saveImage(FILE* f);
+
+  /**
+   * Adopts the arrays of a mapped book image. Pages are read on demand, so
+   * this takes no time, and they are copied only when modified. Each array
+   * moves to the heap, and is unmapped, the first time it grows.
+   */
+  void loadImage(char* data);
+
+  /**
+   * Looks up b in the EGTB, going through probeCache for positions with few
+   * enough pieces. Positions with more pieces may still be scored through
+   * forced captures, see egtbLookupExtended(). Clobbers b.
+   */
+  int cachedEgtbLookup(Board *b);
 
   /**
    * Returns -1 if u is less promising than v, 0 if they are equal or 1 if u
@@ -227,7 +574,9 @@ private:
   /**
    * Finds the most proving node in a PNS tree. Starting with the original
    * board b, also makes the necessary moves modifying b, returning the
-   * position corresponding to the MPN.
+   * position corresponding to the MPN. Rather than descending from startNode
+   * every time, resumes from mpnPath: an update stops at the first ancestor
+   * whose numbers don't change, so the ancestors above it still lead to it.
    * @param startNode Root of subtree to be explored (0 for the whole tree).
    * @param b Board corresponding to startNode.
    * @return The most proving node.
@@ -240,12 +589,6 @@ private:
   /* Sets the proof and disproof numbers for an EGTB board. */
   void setScoreEgtb(int t, int score);
 
-  /**
-   * Copies the PN1 root's moves to our own move array.
-   * @return The number of moves.
-   */
-  int copyMovesFromPn1();
-
   /**
    * Looks up a zobrist key in the transposition table. Depending on the
    * presence of the key and the node's depth, returns one of the existing
@@ -259,10 +602,83 @@ private:
   bool expand(int t, Board *b);
 
   /**
-   * Floats a node rightwards in an edge list to its sorted position. Assumes
-   * the rest of the list is sorted.
+   * Expands the given leaf from the result of a PN1 search of b. Returns
+   * false if it runs out of tree space.
+   */
+  bool expandFromPn1(int t, Board *b, Pn1Searcher *src);
+
+  /**
+   * Creates the children of t for the first nc moves in m. Returns false if
+   * it runs out of tree space.
+   */
+  bool addChildren(int t, Board *b, Move *m, int nc);
+
+  /**
+   * Looks up a PN1 leaf in the EGTB and, failing that, generates its moves.
+   * Touches nothing but the leaf and the caches, so it does not need
+   * treeLock.
+   */
+  void evaluateLeaf(PnsLeaf *l);
+
+  /* Expands a PN1 leaf previously evaluated by evaluateLeaf(). */
+  bool expandLeaf(PnsLeaf *l);
+
+  /**
+   * Selects up to max distinct MPNs. Each one is given VIRTUAL_PN (dis)proof
+   * numbers and its ancestors are updated, so that the next selection takes
+   * a different path.
+   * @return The number of leaves selected.
+   */
+  int selectLeaves(int startNode, Board *b, PnsLeaf *leaf, int max);
+
+  /* Gives the leaves back their real (dis)proof numbers. */
+  void restoreLeaves(PnsLeaf *leaf, int n);
+
+  /**
+   * Returns true iff a leaf restored by restoreLeaves() can still be
+   * expanded. Expanding other leaves in the meantime may have solved it or,
+   * in PN2, trimmed it away.
    */
-  void floatRight(int e);
+  bool isExpandable(PnsLeaf *l);
+
+  /**
+   * Selects up to one MPN per PN1 worker, runs the PN1 searches in parallel,
+   * then expands the MPNs one by one.
+   * @return False if it runs out of tree space.
+   */
+  bool expandParallel(int startNode, Board *b);
+
+  /* Task for parallel PN2. Runs the i-th PN1 worker on its board. */
+  static void runPn1Worker(void *arg, int i);
+
+  /**
+   * Expands the tree from several threads at once until startNode is solved
+   * or the tree is full. Each thread repeatedly selects a leaf, evaluates it
+   * (see evaluateLeaf()) without holding treeLock, then expands it and
+   * updates its ancestors.
+   * @return False if it runs out of tree space.
+   */
+  bool searchParallel(int startNode, Board *b);
+
+  /* Task for tree-parallel PN1. */
+  static void runSearchThread(void *arg, int i);
+
+  /* Expands leaves until the search ends. See searchParallel(). */
+  void searchThread();
+
+  /**
+   * Descends from startNode to a leaf, following the best child at each step,
+   * like selectMpn(), but preferring the children with the fewest threads
+   * going through them. Counts the nodes on the path as busy and records them
+   * in path. Call with treeLock held for reading.
+   * @return The leaf, or NIL, with nothing counted, if another thread is
+   * already expanding it.
+   */
+  int selectShared(int startNode, Board *b, vector<int> *path);
+
+  /* Uncounts the nodes on a path returned by selectShared(). */
+  void releasePath(vector<int> *path);
+
 
   /**
    * Finds the node c in the list of p's children. Moves c to its appropriate
@@ -276,16 +692,65 @@ private:
   void reorder(int p, int c);
 
   /**
-   * Updates the (dis)proof numbers for t based on its children, given that
-   * the (dis)proof numbers of some child c may have changed. Reorders t's
-   * children by (dis)proof.
+   * Floats child[e], one of t's children, rightwards to its sorted
+   * position. Assumes that the children after it are sorted.
+   */
+  void floatRight(int t, int e);
+
+  /**
+   * Sorts t's children by (dis)proof. Takes linear time if only a few
+   * children are out of place.
+   * @param last Index in child of the last child that is out of order with
+   * its right neighbor. Children to its right are already sorted.
+   */
+  void sortChildren(int t, int last);
+
+  /* Returns t's stamp, making room for it if needed. */
+  u32& stampOf(int t);
+
+  /* Starts a new trim generation, see stamp. */
+  void clearSeen();
+
+  /**
+   * Marks t as visited by the current trim generation.
+   * @return False if it was already marked.
+   */
+  bool markSeen(int t);
+
+  /**
+   * Queues t for recomputation, unless it is already queued.
+   * @param c The child that changed, or NIL if t itself changed.
+   */
+  void queueUpdate(int t, int c);
+
+  /**
+   * Recomputes the queued nodes, deepest first, along with every ancestor
+   * whose (dis)proof numbers change as a result. Each node is recomputed once
+   * per call, unless it is shallower than one of its descendants (solved
+   * nodes keep their old depths).
+   */
+  void runUpdates();
+
+  /**
+   * Updates the (dis)proof numbers for t and its ancestors. See
+   * runUpdates().
+   */
+  void update(int t);
+
+  /**
+   * Recomputes t's (dis)proof numbers from its children and re-sorts them,
+   * then trims t if it is won. If a single child changed, reorders just that
+   * child, otherwise sorts them all.
    *
    * Rationale: When selecting the MPN, we can always select the first child,
    * because that's the best child. However, when propagating the scores back
    * up, nodes can have multiple parents, so each node is *not* guaranteed to be
    * its parent's first child.
+   *
+   * @param c The child that changed, or NIL if unknown.
+   * @return True iff the numbers changed (always true for leaves).
    */
-  void update(int t, int c);
+  bool recompute(int t, int c);
 
   /**
    * Severs all links from t to its children and viceversa. Assumes that t's
@@ -306,26 +771,59 @@ private:
   void deleteNode(int t);
 
   /**
-   * Marks t's repetition node as solved and updates that node's ancestors.
-   * Assumes t has just been solved.
+   * Marks t's repetition node as solved and queues it, so that its ancestors
+   * are updated. Assumes t has just been solved.
    */
   void solveRepetition(int t);
 
+  /**
+   * Stores every won or lost node in solvedCache. Draws are left out, since
+   * they can depend on the path through repetitions.
+   */
+  void cacheSolvedNodes();
+
+  /**
+   * Checks a node with children against its children and parents: (dis)proof
+   * numbers, child order, depths and links. Does not need the board.
+   */
+  void verifyLinks(int t);
+
   /**
    * Performs a recursive consistency check of the DAG.
    * @param t Node to verify
    * @param b Board corresponding to t
    * @param seenNodes set of seen nodes (to prevent reentry)
-   * @param seenEdges global set of edge pointers (to check for duplicates)
+   * @param seenEdges global set of parent edge pointers (to check for duplicates)
+   * @param seenChildren global set of child[] indices (to check for overlaps)
+   * @param budget Maximum number of nodes to visit. Decremented as nodes are visited.
    */
   void verifyConsistency(int t, Board *b, unordered_set<int>* seenNodes,
-                         unordered_set<int>* seenEdges);
+                         unordered_set<int>* seenEdges,
+                         unordered_set<int>* seenChildren, int* budget);
 
   /**
-   * Convenience entry point into verifyConsistency().
+   * Convenience entry point into verifyConsistency(). Checks the entire DAG.
    */
   void verifyConsistencyWrapper();
 
+  /**
+   * Checks up to budget nodes in subtrees rooted at the ends of random paths
+   * from the root, VERIFY_SAMPLES subtrees at a time.
+   */
+  void verifySampled(int budget);
+
+  /* Remembers that t was expanded, if we verify incrementally. */
+  void markTouched(int t);
+
+  /**
+   * Runs verifyLinks() on the nodes expanded since the last checkpoint and on
+   * all their ancestors, then forgets them.
+   */
+  void verifyTouched();
+
+  /* Checks the DAG as thoroughly as the verifyLevel option says. */
+  void verifyTree();
+
 };
 
 #endif
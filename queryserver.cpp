@@ -56,7 +56,13 @@ void QueryServer::handlePnsQuery(FILE* fin, FILE* fout, Board* b) {
               cMoves[i].c_str(), cProofs[i], cDisproofs[i], cFens[i].c_str());
     }
   } else {
-    fprintf(fout, "unknown\n");
+    // Fall back to the EGTB if the position converts by forced captures
+    Board bcopy = *b;
+    if (egtbLookupExtended(&bcopy, cfgEgtbCaptureDepth) != EGTB_UNKNOWN) {
+      handleEgtbQuery(fin, fout, b);
+    } else {
+      fprintf(fout, "unknown\n");
+    }
   }
 }
 
@@ -1,5 +1,7 @@
 {* convert colibri scores to human-readable scores *}
-{if $score == 0}
+{if $score == 1000000000 || $score == -1000000000}
+  unknown
+{elseif $score == 0}
   draw
 {else}
   {$hscore=($score>0)?($score-1):(-$score-1)}
@@ -0,0 +1,41 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "logging.h"
+#include "score_cache.h"
+
+ScoreCache::ScoreCache(int sizeMb) {
+  u64 numSlots = 1;
+  while (numSlots * 2 * sizeof(u64) <= ((u64)sizeMb << 20)) {
+    numSlots *= 2;
+  }
+  mask = numSlots - 1;
+  assert(slots = (u64*)calloc(numSlots, sizeof(u64)));
+  lookups = hits = 0;
+}
+
+ScoreCache::~ScoreCache() {
+  free(slots);
+}
+
+bool ScoreCache::get(u64 key, int *score) {
+  // PN1 workers share the cache, so count with atomic increments.
+  __atomic_fetch_add(&lookups, 1, __ATOMIC_RELAXED);
+  u64 x = __atomic_load_n(&slots[key & mask], __ATOMIC_RELAXED);
+  if ((x & ~SCORE_MASK) != (key & ~SCORE_MASK) || !x) {
+    return false;
+  }
+  __atomic_fetch_add(&hits, 1, __ATOMIC_RELAXED);
+  *score = (int)(x & SCORE_MASK) - SCORE_OFFSET;
+  return true;
+}
+
+void ScoreCache::put(u64 key, int score) {
+  assert(score >= -SCORE_OFFSET && score < SCORE_OFFSET);
+  __atomic_store_n(&slots[key & mask], (key & ~SCORE_MASK) | (score + SCORE_OFFSET),
+                   __ATOMIC_RELAXED);
+}
+
+void ScoreCache::logStats(int level, const char *msg) {
+  log(level, "%s cache stats: %llu lookups / %llu hits (%.2f%%), %llu slots",
+      msg, lookups, hits, lookups ? 100.0 * hits / lookups : 0.0, mask + 1);
+}
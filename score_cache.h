@@ -0,0 +1,42 @@
+#ifndef __SCORE_CACHE_H__
+#define __SCORE_CACHE_H__
+#include "defines.h"
+
+/**
+ * A direct-mapped cache from Zobrist keys to small scores. Each slot is a
+ * single 64-bit word holding the upper bits of the key and the score, so
+ * reads and writes are atomic without locks. Colliding keys simply overwrite
+ * each other.
+ */
+class ScoreCache {
+
+  static const int SCORE_BITS = 16;
+  static const u64 SCORE_MASK = (1ull << SCORE_BITS) - 1;
+  static const int SCORE_OFFSET = 1 << (SCORE_BITS - 1); // never store 0
+
+  u64 *slots;
+  u64 mask;           // number of slots - 1
+  u64 lookups, hits;
+
+public:
+
+  /* Creates a cache using at most sizeMb megabytes. */
+  ScoreCache(int sizeMb);
+  ~ScoreCache();
+
+  /**
+   * Looks up a key.
+   * @param score Set to the stored score on hits.
+   * @return True on hits.
+   */
+  bool get(u64 key, int *score);
+
+  /* Stores a score, which must fit in a signed 16-bit integer. */
+  void put(u64 key, int score);
+
+  /* Logs the number of lookups and the hit rate. */
+  void logStats(int level, const char *msg);
+
+};
+
+#endif
@@ -1,17 +1,23 @@
 #define BOOST_TEST_MODULE colibriTest
 #include <boost/test/included/unit_test.hpp>
 #include <unistd.h>
+#include "allocator.h"
 #include "bitmanip.h"
+#include "block_allocator.h"
 #include "configfile.h"
+#include "dfpn.h"
 #include "egtb.h"
 #include "egtb_hash.h"
 #include "fileutil.h"
+#include "huffman.h"
 #include "logging.h"
 #include "lrucache.h"
 #include "movegen.h"
 #include "pns.h"
 #include "precomp.h"
+#include "score_cache.h"
 #include "stringutil.h"
+#include "trans_table.h"
 #include "zobrist.h"
 
 /************************* Tests for bitmanip.cpp *************************/
@@ -289,17 +295,18 @@ BOOST_AUTO_TEST_CASE(testAntidiagonals) {
 /************************* Tests for board.cpp *************************/
 
 BOOST_AUTO_TEST_CASE(testGetPieceCount) {
-  Board *b = fenToBoard(NEW_BOARD);
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard(NEW_BOARD, b);
   BOOST_CHECK_EQUAL(getPieceCount(b), 32);
-  free(b);
 
-  b = fenToBoard("8/8/8/4N3/8/3b4/8/8 w - - 42 1");
+  fenToBoard("8/8/8/4N3/8/3b4/8/8 w - - 42 1", b);
   BOOST_CHECK_EQUAL(getPieceCount(b), 2);
   free(b);
 }
 
 BOOST_AUTO_TEST_CASE(testSwitchSides) {
-  Board *b = fenToBoard("8/8/3b2N1/8/1P6/4p3/8/8 b - b3 0 0");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/8/3b2N1/8/1P6/4p3/8/8 b - b3 0 0", b);
   changeSides(b);
 
   BOOST_CHECK_EQUAL(b->bb[BB_WP], 0x0000100000000000ull);
@@ -325,11 +332,11 @@ BOOST_AUTO_TEST_CASE(testSwitchSides) {
 }
 
 BOOST_AUTO_TEST_CASE(testEpCapturePossible) {
-  Board *b = fenToBoard("8/8/8/pP6/8/8/8/8 w - a6 0 0");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/8/8/pP6/8/8/8/8 w - a6 0 0", b);
   BOOST_CHECK_EQUAL(epCapturePossible(b), true);
-  free(b);
 
-  b = fenToBoard("8/8/8/p7/7P/8/8/8 w - a6 0 0");
+  fenToBoard("8/8/8/p7/7P/8/8/8 w - a6 0 0", b);
   BOOST_CHECK_EQUAL(epCapturePossible(b), false);
   free(b);
 }
@@ -337,7 +344,8 @@ BOOST_AUTO_TEST_CASE(testEpCapturePossible) {
 BOOST_AUTO_TEST_CASE(testCanonicalizeBoard) {
   PieceSet ps[EGTB_MEN];
   int nps = comboToPieceSets("KQvN", ps);
-  Board *b = fenToBoard("8/8/4n3/8/8/Q7/5K2/8 w - - 0 0");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/8/4n3/8/8/Q7/5K2/8 w - - 0 0", b);
   canonicalizeBoard(ps, nps, b, false);
 
   BOOST_CHECK_EQUAL(b->bb[BB_WP], 0ull);
@@ -359,11 +367,10 @@ BOOST_AUTO_TEST_CASE(testCanonicalizeBoard) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xfffffddffffffffbull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, WHITE);
-  free(b);
 
   // En passant case
   nps = comboToPieceSets("NNPvPP", ps);
-  b = fenToBoard("8/2p5/8/1N6/5pP1/8/8/5N2 b - g3 0 0");
+  fenToBoard("8/2p5/8/1N6/5pP1/8/8/5N2 b - g3 0 0", b);
   canonicalizeBoard(ps, nps, b, false);
 
   BOOST_CHECK_EQUAL(b->bb[BB_WP], 0x0000000002000000ull);
@@ -389,7 +396,8 @@ BOOST_AUTO_TEST_CASE(testCanonicalizeBoard) {
 }
 
 BOOST_AUTO_TEST_CASE(testFenToBoard) {
-  Board *b = fenToBoard(NEW_BOARD);
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard(NEW_BOARD, b);
   BOOST_CHECK_EQUAL(b->bb[BB_WP], 0x000000000000ff00ull);
   BOOST_CHECK_EQUAL(b->bb[BB_WN], 0x0000000000000042ull);
   BOOST_CHECK_EQUAL(b->bb[BB_WB], 0x0000000000000024ull);
@@ -409,49 +417,49 @@ BOOST_AUTO_TEST_CASE(testFenToBoard) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0x0000ffffffff0000ull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, WHITE);
-  free(b);
 
   // Position after 1. e4
-  b = fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1");
+  fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1", b);
   BOOST_CHECK_EQUAL(b->bb[BB_WP], 0x000000001000ef00ull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0x0000000000100000);
   BOOST_CHECK_EQUAL(b->side, BLACK);
-  free(b);
 
   // All kinds of wrong things
-  BOOST_CHECK(!fenToBoard("")); // No data
-  BOOST_CHECK(!fenToBoard("3b")); // Incomplete data
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/ppZppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1")); // Illegal piece names
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppp3pppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1")); // Too many squares on one rank
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/ppppppp3/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1")); // Same, but the culprit is a number
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pp2/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1")); // Too few squares on one rank
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR/ppppPPPP b - e3 0 1")); // Too many ranks
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR q - e3 0 1")); // Illegal side name
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1")); // No castling availability please
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNpQKBNR b - e3 0 1")); // Pawn on the first rank
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - z3 0 1")); // Incorrect en passant square name
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e5 0 1")); // En passant square on illegal rank
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/8/4P3/PPPP1PPP/RNBQKBNR b - e3 0 1")); // En passant square is not empty
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPPNPPP/RNBQKBNR b - e3 0 1")); // Square behind en passant square is not empty
-  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/8/8/PPPP1PPP/RNBQKBNR b - e3 0 1")); // No pawn in front of en passant square
+  BOOST_CHECK(!fenToBoard("", b)); // No data
+  BOOST_CHECK(!fenToBoard("3b", b)); // Incomplete data
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/ppZppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1", b)); // Illegal piece names
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppp3pppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1", b)); // Too many squares on one rank
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/ppppppp3/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1", b)); // Same, but the culprit is a number
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pp2/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 1", b)); // Too few squares on one rank
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR/ppppPPPP b - e3 0 1", b)); // Too many ranks
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR q - e3 0 1", b)); // Illegal side name
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", b)); // No castling availability please
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNpQKBNR b - e3 0 1", b)); // Pawn on the first rank
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - z3 0 1", b)); // Incorrect en passant square name
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e5 0 1", b)); // En passant square on illegal rank
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/8/4P3/PPPP1PPP/RNBQKBNR b - e3 0 1", b)); // En passant square is not empty
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/4P3/8/PPPPNPPP/RNBQKBNR b - e3 0 1", b)); // Square behind en passant square is not empty
+  BOOST_CHECK(!fenToBoard("rnbqkbnr/pppppppp/8/8/8/8/PPPP1PPP/RNBQKBNR b - e3 0 1", b)); // No pawn in front of en passant square
+  free(b);
 }
 
 BOOST_AUTO_TEST_CASE(testBoardToFen) {
   const char *s1 = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w - - 0 0";
-  Board *b = fenToBoard(s1);
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard(s1, b);
   BOOST_CHECK_EQUAL(boardToFen(b), s1);
-  free(b);
 
   // Position after 1. e4
   const char *s2 = "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b - e3 0 0";
-  b = fenToBoard(s2);
+  fenToBoard(s2, b);
   BOOST_CHECK_EQUAL(boardToFen(b), s2);
   free(b);
 }
 
 BOOST_AUTO_TEST_CASE(testMakeWhiteMove) {
   // Regular move: queen e4-h7
-  Board *b = fenToBoard("8/8/8/8/4Q3/8/8/8 w - - 42 1");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/8/8/8/4Q3/8/8/8 w - - 42 1", b);
   Move m1 = { QUEEN, 28, 55, 0 };
   makeMove(b, m1);
 
@@ -474,10 +482,9 @@ BOOST_AUTO_TEST_CASE(testMakeWhiteMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xff7fffffffffffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, BLACK);
-  free(b);
 
   // Pawn push: h2h4
-  b = fenToBoard("8/8/8/8/8/8/7P/8 w - - 42 1");
+  fenToBoard("8/8/8/8/8/8/7P/8 w - - 42 1", b);
   Move m2 = { PAWN, 15, 31, 0 };
   makeMove(b, m2);
 
@@ -500,10 +507,9 @@ BOOST_AUTO_TEST_CASE(testMakeWhiteMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xffffffff7fffffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0x0000000000800000ull);
   BOOST_CHECK_EQUAL(b->side, BLACK);
-  free(b);
 
   // Capture: Ne5xd3
-  b = fenToBoard("8/8/8/4N3/8/3b4/8/8 w - - 42 1");
+  fenToBoard("8/8/8/4N3/8/3b4/8/8 w - - 42 1", b);
   Move m3 = { KNIGHT, 36, 19, 0 };
   makeMove(b, m3);
 
@@ -526,10 +532,9 @@ BOOST_AUTO_TEST_CASE(testMakeWhiteMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xfffffffffff7ffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, BLACK);
-  free(b);
 
   // Promotion: a7a8Q
-  b = fenToBoard("8/P7/8/8/8/8/8/8 w - - 42 1");
+  fenToBoard("8/P7/8/8/8/8/8/8 w - - 42 1", b);
   Move m4 = { PAWN, 48, 56, QUEEN };
   makeMove(b, m4);
 
@@ -552,10 +557,9 @@ BOOST_AUTO_TEST_CASE(testMakeWhiteMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xfeffffffffffffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, BLACK);
-  free(b);
 
   // En passant capture: c5xb6
-  b = fenToBoard("8/8/8/1pP5/8/8/8/8 w - b6 42 1");
+  fenToBoard("8/8/8/1pP5/8/8/8/8 w - b6 42 1", b);
   Move m5 = { PAWN, 34, 41, 0 };
   makeMove(b, m5);
 
@@ -583,7 +587,8 @@ BOOST_AUTO_TEST_CASE(testMakeWhiteMove) {
 
 BOOST_AUTO_TEST_CASE(testMakeBlackMove) {
   // Regular move: queen e4-h7
-  Board *b = fenToBoard("8/8/8/8/4q3/8/8/8 b - - 42 1");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/8/8/8/4q3/8/8/8 b - - 42 1", b);
   Move m1 = { QUEEN, 28, 55, 0 };
   makeMove(b, m1);
 
@@ -606,10 +611,9 @@ BOOST_AUTO_TEST_CASE(testMakeBlackMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xff7fffffffffffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, WHITE);
-  free(b);
 
   // Pawn push: h7h5
-  b = fenToBoard("8/7p/8/8/8/8/8/8 b - - 42 1");
+  fenToBoard("8/7p/8/8/8/8/8/8 b - - 42 1", b);
   Move m2 = { PAWN, 55, 39, 0 };
   makeMove(b, m2);
 
@@ -632,10 +636,9 @@ BOOST_AUTO_TEST_CASE(testMakeBlackMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xffffff7fffffffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0x0000800000000000ull);
   BOOST_CHECK_EQUAL(b->side, WHITE);
-  free(b);
 
   // Capture: Ne5xd3
-  b = fenToBoard("8/8/8/4n3/8/3B4/8/8 b - - 42 1");
+  fenToBoard("8/8/8/4n3/8/3B4/8/8 b - - 42 1", b);
   Move m3 = { KNIGHT, 36, 19, 0 };
   makeMove(b, m3);
 
@@ -658,10 +661,9 @@ BOOST_AUTO_TEST_CASE(testMakeBlackMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xfffffffffff7ffffull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, WHITE);
-  free(b);
 
   // Promotion: a2a1Q
-  b = fenToBoard("8/8/8/8/8/8/p7/8 b - - 42 1");
+  fenToBoard("8/8/8/8/8/8/p7/8 b - - 42 1", b);
   Move m4 = { PAWN, 8, 0, QUEEN };
   makeMove(b, m4);
 
@@ -684,10 +686,9 @@ BOOST_AUTO_TEST_CASE(testMakeBlackMove) {
   BOOST_CHECK_EQUAL(b->bb[BB_EMPTY], 0xfffffffffffffffeull);
   BOOST_CHECK_EQUAL(b->bb[BB_EP], 0ull);
   BOOST_CHECK_EQUAL(b->side, WHITE);
-  free(b);
 
   // En passant capture: c4xb3
-  b = fenToBoard("8/8/8/8/1Pp5/8/8/8 b - b3 42 1");
+  fenToBoard("8/8/8/8/1Pp5/8/8/8 b - b3 42 1", b);
   Move m5 = { PAWN, 26, 17, 0 };
   makeMove(b, m5);
 
@@ -715,10 +716,12 @@ BOOST_AUTO_TEST_CASE(testMakeBlackMove) {
 
 BOOST_AUTO_TEST_CASE(testMakeBackwardMove) {
   const char *fen = "3r1q2/2pb2k1/5n2/8/8/2N5/1K2BP2/2Q1R3 w - - 0 0";
-  Board *witness = fenToBoard(fen);
+  Board *witness = (Board*)malloc(sizeof(Board));
+  fenToBoard(fen, witness);
   Move m[MAX_MOVES];
 
-  Board *b = fenToBoard(fen);
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard(fen, b);
   int numMoves = getAllMoves(b, m, FORWARD);
   for (int i = 0; i < numMoves; i++) {
     makeMove(b, m[i]);
@@ -749,7 +752,10 @@ BOOST_AUTO_TEST_CASE(testMakeMoveSequence) {
   string s1[4] = { "e3", "e6", "b4", "Bxb4"};
   Board b;
   fenToBoard(NEW_BOARD, &b);
-  makeMoveSequence(&b, 4, s1);
+  // The moves must stay inside the tree, so grow one deep enough to contain Bxb4
+  Pns pns(30000, 0);
+  pns.search(&b);
+  pns.makeMoveSequence(&b, 4, s1);
   string fen = boardToFen(&b);
   BOOST_CHECK_EQUAL(fen.compare("rnbqk1nr/pppp1ppp/4p3/8/1b6/4P3/P1PP1PPP/RNBQKBNR w - - 0 0"), 0);
 }
@@ -757,54 +763,49 @@ BOOST_AUTO_TEST_CASE(testMakeMoveSequence) {
 /************************* Tests for movegen.cpp *************************/
 
 BOOST_AUTO_TEST_CASE(testGetWhiteMoves) {
-  Board *b;
+  Board *b = (Board*)malloc(sizeof(Board));
   Move m[100];
   string s[100];
 
-  b = fenToBoard(NEW_BOARD);
+  fenToBoard(NEW_BOARD, b);
   int numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected1[] = { "a3", "b3", "c3", "d3", "e3", "f3", "g3", "h3", "a4", "b4", "c4", "d4", "e4", "f4", "g4", "h4", "Na3", "Nc3", "Nf3", "Nh3" };
   BOOST_CHECK_EQUAL(numMoves, 20);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected1, expected1 + numMoves);
-  free(b);
 
-  b = fenToBoard("4q3/8/8/pP3N2/6K1/R5b1/5n1P/4Q3 w - a6 0 1");
+  fenToBoard("4q3/8/8/pP3N2/6K1/R5b1/5n1P/4Q3 w - a6 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected2[] = { "hxg3", "bxa6", "Nxg3", "Rxg3", "Rxa5", "Qxe8", "Qxf2", "Qxa5", "Kxg3" };
   BOOST_CHECK_EQUAL(numMoves, 9);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected2, expected2 + numMoves);
-  free(b);
 
-  b = fenToBoard("8/4P3/8/8/8/8/q7/8 w - - 0 1");
+  fenToBoard("8/4P3/8/8/8/8/q7/8 w - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected3[] = { "e8=N", "e8=B", "e8=R", "e8=Q", "e8=K" };
   BOOST_CHECK_EQUAL(numMoves, 5);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected3, expected3 + numMoves);
-  free(b);
 
   // Both the c and e white pawns can capture en passant
-  b = fenToBoard("8/8/8/2PpP3/8/8/8/8 w - d6 0 1");
+  fenToBoard("8/8/8/2PpP3/8/8/8/8 w - d6 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected4[] = { "cxd6", "exd6" };
   BOOST_CHECK_EQUAL(numMoves, 2);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected4, expected4 + numMoves);
-  free(b);
 
   // Resolving ambiguities
-  b = fenToBoard("8/2q4q/8/7q/1N6/8/1N3N2/6N1 w - - 0 1");
+  fenToBoard("8/2q4q/8/7q/1N6/8/1N3N2/6N1 w - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected5[] = { "Ne2", "Nf3", "Ngh3", "Nbd1", "Nb2d3", "Na4", "Nc4", "Nfd1", "Nh1", "Nfd3", "Nfh3", "Ne4", "Ng4", "Na2", "Nc2", "N4d3", "Nd5", "Na6", "Nc6" };
   BOOST_CHECK_EQUAL(numMoves, 19);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected5, expected5 + numMoves);
-  free(b);
 
   // Resolving ambiguities
-  b = fenToBoard("8/2Q4Q/8/7Q/1n6/8/1n3n2/6n1 w - - 0 1");
+  fenToBoard("8/2Q4Q/8/7Q/1n6/8/1n3n2/6n1 w - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected6[] = { "Qha5", "Qb5", "Qhc5", "Qd5", "Qhe5", "Q5f5", "Qg5", "Qa7", "Qb7", "Qcd7", "Qce7", "Qcf7", "Qcg7", "Qhd7", "Qhe7", "Qh7f7",
@@ -812,10 +813,9 @@ BOOST_AUTO_TEST_CASE(testGetWhiteMoves) {
     "Qb6", "Qd8", "Qb1", "Qhc2", "Qd3", "Qe4", "Q7f5", "Q7g6", "Q5g6", "Q5f7", "Qe8", "Qch2", "Qg3", "Qf4", "Qce5", "Qd6", "Qb8", "Qg8", };
   BOOST_CHECK_EQUAL(numMoves, 54);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected6, expected6 + numMoves);
-  free(b);
 
   // Diagonal and antidiagonal moves
-  b = fenToBoard("8/3Q4/1B6/8/4B1B1/8/3B4/k7 w - - 0 1");
+  fenToBoard("8/3Q4/1B6/8/4B1B1/8/3B4/k7 w - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected7[] = { "Bc1", "Bde3", "Bf4", "Bg5", "Bh6", "Bb1", "Bc2", "Bd3", "Bef5", "Bg6", "Bh7", "Bd1", "Be2", "Bgf3", "Bh5", "Bba5", "Bc7",
@@ -827,54 +827,49 @@ BOOST_AUTO_TEST_CASE(testGetWhiteMoves) {
 }
 
 BOOST_AUTO_TEST_CASE(testGetBlackMoves) {
-  Board *b;
+  Board *b = (Board*)malloc(sizeof(Board));
   Move m[100];
   string s[100];
 
-  b = fenToBoard("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR b - - 0 1");
+  fenToBoard("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR b - - 0 1", b);
   int numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected1[] = { "a6", "b6", "c6", "d6", "e6", "f6", "g6", "h6", "a5", "b5", "c5", "d5", "e5", "f5", "g5", "h5", "Na6", "Nc6", "Nf6", "Nh6" };
   BOOST_CHECK_EQUAL(numMoves, 20);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected1, expected1 + numMoves);
-  free(b);
 
-  b = fenToBoard("4q3/5N1p/r5B1/6k1/Pp3n2/8/8/4Q3 b - a3 0 1");
+  fenToBoard("4q3/5N1p/r5B1/6k1/Pp3n2/8/8/4Q3 b - a3 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected2[] = { "bxa3", "hxg6", "Nxg6", "Rxg6", "Rxa4", "Qxe1", "Qxa4", "Qxf7", "Kxg6" };
   BOOST_CHECK_EQUAL(numMoves, 9);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected2, expected2 + numMoves);
-  free(b);
 
-  b = fenToBoard("8/Q7/8/8/8/8/4p3/8 b - - 0 1");
+  fenToBoard("8/Q7/8/8/8/8/4p3/8 b - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected3[] = { "e1=N", "e1=B", "e1=R", "e1=Q", "e1=K" };
   BOOST_CHECK_EQUAL(numMoves, 5);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected3, expected3 + numMoves);
-  free(b);
 
   // Both the c and e white pawns can capture en passant
-  b = fenToBoard("8/8/8/8/2pPp3/8/8/8 b - d3 0 1");
+  fenToBoard("8/8/8/8/2pPp3/8/8/8 b - d3 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected4[] = { "cxd3", "exd3" };
   BOOST_CHECK_EQUAL(numMoves, 2);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected4, expected4 + numMoves);
-  free(b);
 
   // Resolving ambiguities
-  b = fenToBoard("6n1/1n3n2/8/1n6/7Q/8/2Q4Q/8 b - - 0 1");
+  fenToBoard("6n1/1n3n2/8/1n6/7Q/8/2Q4Q/8 b - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected5[] = { "Na3", "Nc3", "Nd4", "N5d6", "Na7", "Nc7", "Na5", "Nc5", "Nb7d6", "Nbd8", "Ne5", "Ng5", "Nfd6", "Nfh6", "Nfd8", "Nh8", "Nf6", "Ngh6", "Ne7" };
   BOOST_CHECK_EQUAL(numMoves, 19);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected5, expected5 + numMoves);
-  free(b);
 
   // Resolving ambiguities
-  b = fenToBoard("6N1/1N3N2/8/1N6/7q/8/2q4q/8 b - - 0 1");
+  fenToBoard("6N1/1N3N2/8/1N6/7q/8/2q4q/8 b - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected6[] = { "Qa2", "Qb2", "Qcd2", "Qce2", "Qcf2", "Qcg2", "Qhd2", "Qhe2", "Qh2f2", "Qhg2", "Qha4", "Qb4", "Qhc4", "Qd4", "Qhe4",
@@ -882,10 +877,9 @@ BOOST_AUTO_TEST_CASE(testGetBlackMoves) {
     "Qg6", "Qch7", "Qg1", "Qe1", "Q4f2", "Q4g3", "Qd1", "Qb3", "Qca4", "Q2g3", "Q2f4", "Qe5", "Qd6", "Qhc7", "Qb8", "Qg5", "Qf6", "Qe7", "Qd8", };
   BOOST_CHECK_EQUAL(numMoves, 54);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected6, expected6 + numMoves);
-  free(b);
 
   // Diagonal and antidiagonal moves
-  b = fenToBoard("K7/3b4/8/4b1b1/8/1b6/3q4/8 b - - 0 1");
+  fenToBoard("K7/3b4/8/4b1b1/8/1b6/3q4/8 b - - 0 1", b);
   numMoves = getAllMoves(b, m, FORWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected7[] = { "Ba2", "Bc4", "Bd5", "Bbe6", "Bf7", "Bg8", "Ba1", "Bb2", "Bc3", "Bd4", "Bef6", "Bg7", "Bh8", "Be3", "Bgf4", "Bh6", "Bda4",
@@ -900,7 +894,8 @@ BOOST_AUTO_TEST_CASE(testGetBackwardMoves) {
   Move m[100];
   string s[100];
 
-  Board *b = fenToBoard("8/2Pq3p/6n1/3pB2R/1N1K1P2/1k1Q4/8/4r1b1 b - - 0 0");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/2Pq3p/6n1/3pB2R/1N1K1P2/1k1Q4/8/4r1b1 b - - 0 0", b);
   int numMoves = getAllMoves(b, m, BACKWARD);
   getAlgebraicNotation(b, m, numMoves, s);
   const char *expected1[] = { "f3", "c6", "f2", "Na2", "Nc2", "Na6", "Nc6", "Bf6", "Bg7", "Bh8", "Bd6", "Rf5", "Rg5", "Rh1", "Rh2", "Rh3", "Rh4", "Rh6",
@@ -915,19 +910,17 @@ BOOST_AUTO_TEST_CASE(testGetBackwardMoves) {
     "Qg7", "Qd6", "Qd8", "Qa4", "Qb5", "Qc6", "Qe8", "Qh3", "Qg4", "Qf5", "Qe6", "Qc8", "Ka2", "Kb2", "Kc2", "Ka3", "Kc3", "Ka4", "Kc4" };
   BOOST_CHECK_EQUAL(numMoves, 37);
   BOOST_CHECK_EQUAL_COLLECTIONS(s, s + numMoves, expected2, expected2 + numMoves);
-  free(b);
 
   // When the EP bit is set, the only legal move that could have been made is the double pawn push
-  b = fenToBoard("8/8/8/2p2p2/8/8/P7/8 w - f6 0 0");
+  fenToBoard("8/8/8/2p2p2/8/8/P7/8 w - f6 0 0", b);
   numMoves = getAllMoves(b, m, BACKWARD);
   BOOST_CHECK_EQUAL(numMoves, 1);
   BOOST_CHECK_EQUAL(m[0].piece, PAWN);
   BOOST_CHECK_EQUAL(m[0].from, 37);
   BOOST_CHECK_EQUAL(m[0].to, 53);
   BOOST_CHECK_EQUAL(m[0].promotion, 0);
-  free(b);
 
-  b = fenToBoard("8/p7/8/8/2P2P2/8/8/8 b - c3 0 0");
+  fenToBoard("8/p7/8/8/2P2P2/8/8/8 b - c3 0 0", b);
   numMoves = getAllMoves(b, m, BACKWARD);
   BOOST_CHECK_EQUAL(numMoves, 1);
   BOOST_CHECK_EQUAL(m[0].piece, PAWN);
@@ -983,25 +976,22 @@ BOOST_AUTO_TEST_CASE(testComboToPieceSets) {
 BOOST_AUTO_TEST_CASE(testEncodeEGTBBoard) {
   PieceSet ps[EGTB_MEN];
   int nps;
-  Board *b;
+  Board *b = (Board*)malloc(sizeof(Board));
 
   nps = comboToPieceSets("RBvNN", ps);
-  b = fenToBoard("8/3n4/5R2/2B5/8/6n1/8/8 w - - 0 0");
+  fenToBoard("8/3n4/5R2/2B5/8/6n1/8/8 w - - 0 0", b);
   BOOST_CHECK_EQUAL(encodeEgtbBoard(ps, nps, b), 0b1000101011010101101100110);
-  free(b);
 
   nps = comboToPieceSets("NNvPP", ps);
-  b = fenToBoard("2N5/8/4p3/8/5N2/2p5/8/8 b - - 0 0");
+  fenToBoard("2N5/8/4p3/8/5N2/2p5/8/8 b - - 0 0", b);
   BOOST_CHECK_EQUAL(encodeEgtbBoard(ps, nps, b), 0b0100101011000111011110101);
-  free(b);
 
   nps = comboToPieceSets("NNvPP", ps);
-  b = fenToBoard("2N5/8/8/4p3/5N2/2p5/8/8 w - e6 0 0");
+  fenToBoard("2N5/8/8/4p3/5N2/2p5/8/8 w - e6 0 0", b);
   BOOST_CHECK_EQUAL(encodeEgtbBoard(ps, nps, b), 0b0100101111000111011110100);
-  free(b);
 
   nps = comboToPieceSets("PPvP", ps);
-  b = fenToBoard("8/8/8/8/2PpP3/8/8/8 b - c3 0 0");
+  fenToBoard("8/8/8/8/2PpP3/8/8/8 b - c3 0 0", b);
   BOOST_CHECK_EQUAL(encodeEgtbBoard(ps, nps, b), 0b0000100111000110111);
   free(b);
 }
@@ -1131,35 +1121,29 @@ BOOST_AUTO_TEST_CASE(testGetEgtbSize) {
 }
 
 BOOST_AUTO_TEST_CASE(testGetEgtbIndex) {
-  Board *b;
+  Board *b = (Board*)malloc(sizeof(Board));
   PieceSet ps[EGTB_MEN];
   int nps;
 
   nps = comboToPieceSets("KvR", ps);
-  b = fenToBoard("8/8/8/8/8/8/8/Kr6 w - - 0 0");
+  fenToBoard("8/8/8/8/8/8/8/Kr6 w - - 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 0);
-  free(b);
-  b = fenToBoard("r7/8/8/8/8/8/8/K7 w - - 0 0");
+  fenToBoard("r7/8/8/8/8/8/8/K7 w - - 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 110);
-  free(b);
-  b = fenToBoard("r7/8/8/8/8/8/8/K7 b - - 0 0");
+  fenToBoard("r7/8/8/8/8/8/8/K7 b - - 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 111);
-  free(b);
-  b = fenToBoard("r7/8/8/8/3K4/8/8/8 w - - 0 0");
+  fenToBoard("r7/8/8/8/3K4/8/8/8 w - - 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 1244);
-  free(b);
 
   nps = comboToPieceSets("QPPvNP", ps);
-  b = fenToBoard("8/8/8/5p2/2n5/P7/3P4/5Q2 b - - 0 0");
+  fenToBoard("8/8/8/5p2/2n5/P7/3P4/5Q2 b - - 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 6595967);
-  free(b);
 
   // En passant cases
   nps = comboToPieceSets("NNPvPP", ps);
-  b = fenToBoard("8/8/N4N2/1pP5/8/5p2/8/8 w - b6 0 0");
+  fenToBoard("8/8/N4N2/1pP5/8/5p2/8/8 w - b6 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 95128708);
-  free(b);
-  b = fenToBoard("8/5N2/8/5p2/NpP5/8/8/8 b - c3 0 0");
+  fenToBoard("8/5N2/8/5p2/NpP5/8/8/8 b - c3 0 0", b);
   BOOST_CHECK_EQUAL(getEgtbIndex(ps, nps, b), 95751805);
   free(b);
 }
@@ -1177,6 +1161,32 @@ BOOST_AUTO_TEST_CASE(testGetFileSize) {
   BOOST_CHECK_EQUAL(getFileSize("/tmp/foo.dat"), 0);
 }
 
+BOOST_AUTO_TEST_CASE(testVlq) {
+  u64 values[] = { 0, 1, 127, 128, 16383, 16384, INFTY64, 0xffffffffffffffffull };
+  byte buf[100], *p = buf;
+  FILE *f = fopen("/tmp/foo.dat", "w");
+  for (u64 x: values) {
+    writeVlq(x, &p);
+    writeVlq(x, f);
+  }
+  fclose(f);
+  BOOST_CHECK_EQUAL(p - buf, 1 + 1 + 1 + 2 + 2 + 3 + 9 + 10);
+
+  // The memory and file encodings agree.
+  byte buf2[100];
+  f = fopen("/tmp/foo.dat", "r");
+  BOOST_CHECK_EQUAL(fread(buf2, 1, 100, f), p - buf);
+  BOOST_CHECK(!memcmp(buf, buf2, p - buf));
+  rewind(f);
+
+  p = buf;
+  for (u64 x: values) {
+    BOOST_CHECK_EQUAL(readVlq(&p), x);
+    BOOST_CHECK_EQUAL(readVlq(f), x);
+  }
+  fclose(f);
+}
+
 /************************* Tests for lruCache.cpp *************************/
 
 BOOST_AUTO_TEST_CASE(testLruCache) {
@@ -1255,39 +1265,33 @@ BOOST_AUTO_TEST_CASE(testIsFen) {
 BOOST_AUTO_TEST_CASE(testPnsTrivial) {
   logInit("stderr");
   loadConfigFile(CONFIG_FILE);
+  zobristInit();
   initEgtb();
 
-  Pns pns(1000, 10000, NULL);
-  Board* b = fenToBoard("7r/8/8/8/8/8/8/K7 w - - 0 0"); // KvR: EGTB loss
-  pns.analyzeBoard(b);
+  Pns pns(11000, 0);
+  Board* b = (Board*)malloc(sizeof(Board));
+  fenToBoard("7r/8/8/8/8/8/8/K7 w - - 0 0", b); // KvR: EGTB loss
+  pns.search(b);
   BOOST_CHECK_EQUAL(pns.getProof(), INFTY64);
   BOOST_CHECK_EQUAL(pns.getDisproof(), 0);
-  free(b);
 
-  pns.reset();
-  b = fenToBoard("7r/8/8/8/8/8/8/K7 b - - 0 0");  // RvK: EGTB win
-  pns.analyzeBoard(b);
+  fenToBoard("7r/8/8/8/8/8/8/K7 b - - 0 0", b);  // RvK: EGTB win
+  pns.search(b);
   BOOST_CHECK_EQUAL(pns.getProof(), 0);
   BOOST_CHECK_EQUAL(pns.getDisproof(), INFTY64);
-  free(b);
 
-  pns.reset();
-  b = fenToBoard("8/p4p2/P1p2P2/2P5/8/8/8/8 w - - 0 0");  // 3Pv3P with no moves: draw
-  pns.analyzeBoard(b);
+  fenToBoard("8/p4p2/P1p2P2/2P5/8/8/8/8 w - - 0 0", b);  // 3Pv3P with no moves: draw
+  pns.search(b);
   BOOST_CHECK_EQUAL(pns.getProof(), INFTY64);
   BOOST_CHECK_EQUAL(pns.getDisproof(), INFTY64);
-  free(b);
 
-  pns.reset();
-  b = fenToBoard("8/p1p2p2/P1p2P2/2P5/8/8/8/8 w - - 0 0");  // 3Pv4P with no moves: win
-  pns.analyzeBoard(b);
+  fenToBoard("8/p1p2p2/P1p2P2/2P5/8/8/8/8 w - - 0 0", b);  // 3Pv4P with no moves: win
+  pns.search(b);
   BOOST_CHECK_EQUAL(pns.getProof(), 0);
   BOOST_CHECK_EQUAL(pns.getDisproof(), INFTY64);
-  free(b);
 
-  pns.reset();
-  b = fenToBoard("8/p4p2/P1p2P2/2P5/2P5/8/8/8 w - - 0 0");  // 4Pv3P with no moves: draw
-  pns.analyzeBoard(b);
+  fenToBoard("8/p4p2/P1p2P2/2P5/2P5/8/8/8 w - - 0 0", b);  // 4Pv3P with no moves: draw
+  pns.search(b);
   BOOST_CHECK_EQUAL(pns.getProof(), INFTY64);
   BOOST_CHECK_EQUAL(pns.getDisproof(), INFTY64);
   free(b);
@@ -1296,20 +1300,22 @@ BOOST_AUTO_TEST_CASE(testPnsTrivial) {
 BOOST_AUTO_TEST_CASE(testPnsAnalyzeBoard) {
   zobristInit();
 
-  Board* b = fenToBoard("8/p2p4/3p4/1P6/1P6/1P6/1P6/8 b - - 0 0");
+  Board* b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/p2p4/3p4/1P6/1P6/1P6/1P6/8 b - - 0 0", b);
 
   // Create a PNS tree just large enough to run into the transposition after a5 bxa6 and a6 bxa6
-  Pns pns(28, 10000, NULL);
-  pns.analyzeBoard(b);
+  // (28 nodes, plus the 10,000 nodes of headroom that isFull() keeps)
+  Pns pns(10028, 0);
+  pns.search(b);
 
   PnsNode t = pns.node[0];
-  PnsNodeList c0 = pns.edge[t.child];
-  PnsNodeList c1 = pns.edge[c0.next];
-  PnsNodeList c2 = pns.edge[c1.next];
+  PnsChild c0 = pns.child[t.child];
+  PnsChild c1 = pns.child[t.child + 1];
+  PnsChild c2 = pns.child[t.child + 2];
   BOOST_CHECK_EQUAL(t.proof, 2);
   BOOST_CHECK_EQUAL(t.disproof, INFTY64);
   BOOST_CHECK_EQUAL(t.parent, NIL);
-  BOOST_CHECK_EQUAL(c2.next, NIL);
+  BOOST_CHECK_EQUAL(t.numChildren, 3);
 
   BOOST_CHECK_EQUAL(c0.move.from, 48);
   BOOST_CHECK_EQUAL(c0.move.to, 40);
@@ -1321,13 +1327,13 @@ BOOST_AUTO_TEST_CASE(testPnsAnalyzeBoard) {
   // gc is the grandchild after (a5 bxa6ep). This is the transposition, also
   // reachable after a6 bxa6.
   PnsNode gc = pns.node[22];
-  c0 = pns.edge[gc.child];
+  c0 = pns.child[gc.child];
   PnsNodeList p0 = pns.edge[gc.parent];
   PnsNodeList p1 = pns.edge[p0.next];
 
   BOOST_CHECK_EQUAL(gc.proof, 2);
   BOOST_CHECK_EQUAL(gc.disproof, 1);
-  BOOST_CHECK_EQUAL(c0.next, NIL);
+  BOOST_CHECK_EQUAL(gc.numChildren, 1);
   BOOST_CHECK_EQUAL(p1.next, NIL);
   BOOST_CHECK_EQUAL(c0.move.from, 43);
   BOOST_CHECK_EQUAL(c0.move.to, 35);
@@ -1335,23 +1341,128 @@ BOOST_AUTO_TEST_CASE(testPnsAnalyzeBoard) {
   // Its parents are a5 and a6, reachable from the root node (indices 2 and 3).
   BOOST_CHECK_EQUAL(p0.node, 1);
   BOOST_CHECK_EQUAL(p1.node, 2);
+  free(b);
+}
 
+BOOST_AUTO_TEST_CASE(testPnsTreeParallel) {
+  zobristInit();
+  cfgPn1Threads = 4;
+
+  Pns pns(40000, 0);
+  Board* b = (Board*)malloc(sizeof(Board));
+  fenToBoard("7r/8/8/8/8/8/8/K7 w - - 0 0", b); // KvR: EGTB loss
+  pns.search(b);
+  BOOST_CHECK_EQUAL(pns.getProof(), INFTY64);
+  BOOST_CHECK_EQUAL(pns.getDisproof(), 0);
+
+  // A draw that takes several thousand expansions to prove
+  fenToBoard("8/p2p4/3p4/1P6/1P6/1P6/1P6/8 b - - 0 0", b);
+  pns.search(b);
+  BOOST_CHECK_EQUAL(pns.getProof(), INFTY64);
+  BOOST_CHECK_EQUAL(pns.getDisproof(), INFTY64);
   free(b);
+  cfgPn1Threads = 1;
+}
+
+BOOST_AUTO_TEST_CASE(testPnsJournalTornRecord) {
+  zobristInit();
+  cfgSaveEvery = 1000000;
+  cfgJournalSyncEvery = 1000000;
+  cfgPn2Threads = 1;
+  string book = "/tmp/colibri-test.book", journal = book + ".journal";
+  unlink(journal.c_str());
+  unlink((journal + ".old").c_str());
+  Pns pn1(12000, 0);
+
+  // Save a 1-node book, then journal some expansions on top of it.
+  {
+    Pns pn2(11000, 0, &pn1, book);
+    fenToBoard(NEW_BOARD, &pn2.board);
+    pn2.collapse();
+    pn2.save();
+  }
+  {
+    Pns pn2(12000, 0, &pn1, book);
+    pn2.load();
+    pn2.analyze();
+    pn2.syncJournal();
+  }
+
+  // Tear the last record, as a crash might. Loading drops it, so that the
+  // records journaled afterwards can be replayed.
+  unsigned size = getFileSize(journal.c_str());
+  BOOST_CHECK_EQUAL(truncate(journal.c_str(), size - 5), 0);
+  u64 proof, disproof;
+  {
+    Pns pn2(14000, 0, &pn1, book);
+    pn2.load();
+    BOOST_CHECK(getFileSize(journal.c_str()) < size - 5);
+    pn2.analyze();
+    pn2.syncJournal();
+    proof = pn2.getProof();
+    disproof = pn2.getDisproof();
+  }
+  size = getFileSize(journal.c_str());
+  {
+    Pns pn2(14000, 0, &pn1, book);
+    pn2.load();
+    BOOST_CHECK_EQUAL(getFileSize(journal.c_str()), size);
+    BOOST_CHECK_EQUAL(pn2.getProof(), proof);
+    BOOST_CHECK_EQUAL(pn2.getDisproof(), disproof);
+  }
+  unlink(book.c_str());
+  unlink(journal.c_str());
+}
+
+/************************* Tests for dfpn.cpp *************************/
+
+BOOST_AUTO_TEST_CASE(testDfpnTrivial) {
+  zobristInit();
+  Dfpn dfpn(1000, 1);
+  Board b;
+  Move m[MAX_MOVES];
+  u64 proof[MAX_MOVES], disproof[MAX_MOVES];
+
+  fenToBoard("7r/8/8/8/8/8/8/K7 w - - 0 0", &b); // KvR: EGTB loss
+  dfpn.search(&b);
+  BOOST_CHECK_EQUAL(dfpn.getProof(), INFTY64);
+  BOOST_CHECK_EQUAL(dfpn.getDisproof(), 0);
+  BOOST_CHECK_EQUAL(dfpn.getChildren(m, proof, disproof), 0);
+
+  fenToBoard("8/p4p2/P1p2P2/2P5/8/8/8/8 w - - 0 0", &b);  // 3Pv3P with no moves: draw
+  dfpn.search(&b);
+  BOOST_CHECK_EQUAL(dfpn.getProof(), INFTY64);
+  BOOST_CHECK_EQUAL(dfpn.getDisproof(), INFTY64);
+
+  fenToBoard("8/p1p2p2/P1p2P2/2P5/8/8/8/8 w - - 0 0", &b);  // 3Pv4P with no moves: win
+  dfpn.search(&b);
+  BOOST_CHECK_EQUAL(dfpn.getProof(), 0);
+  BOOST_CHECK_EQUAL(dfpn.getDisproof(), INFTY64);
+
+  // Black must capture, then white has no moves and fewer pieces: a loss,
+  // with the capture as the only child.
+  fenToBoard("8/p4p1p/P1p2P1P/1P6/8/8/8/8 b - - 0 0", &b);
+  dfpn.search(&b);
+  BOOST_CHECK_EQUAL(dfpn.getProof(), INFTY64);
+  BOOST_CHECK_EQUAL(dfpn.getDisproof(), 0);
+  BOOST_CHECK_EQUAL(dfpn.getChildren(m, proof, disproof), 1);
+  BOOST_CHECK_EQUAL(proof[0], 0);
+  BOOST_CHECK_EQUAL(disproof[0], INFTY64);
 }
 
 /************************* Tests for zobrist.cpp *************************/
 
 BOOST_AUTO_TEST_CASE(testGetZobrist) {
   zobristInit();
-  Board *b = fenToBoard("8/8/2k5/8/4P1Q1/1B6/8/8 w - - 0 1");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("8/8/2k5/8/4P1Q1/1B6/8/8 w - - 0 1", b);
   BOOST_CHECK_EQUAL(getZobrist(b),
                     zrBoard[42][BLACK][KING] ^
                     zrBoard[30][WHITE][QUEEN] ^
                     zrBoard[28][WHITE][PAWN] ^
                     zrBoard[17][WHITE][BISHOP]);
-  free(b);
 
-  b = fenToBoard("8/8/2k5/8/4P1Q1/1B6/8/8 b - e3 0 1");
+  fenToBoard("8/8/2k5/8/4P1Q1/1B6/8/8 b - e3 0 1", b);
   BOOST_CHECK_EQUAL(getZobrist(b),
                     zrBoard[42][BLACK][KING] ^
                     zrBoard[30][WHITE][QUEEN] ^
@@ -1364,7 +1475,8 @@ BOOST_AUTO_TEST_CASE(testGetZobrist) {
 
 BOOST_AUTO_TEST_CASE(testUpdateZobrist) {
   zobristInit();
-  Board *b = fenToBoard("7r/3p4/8/8/8/8/4P3/N7 w - - 0 1");
+  Board *b = (Board*)malloc(sizeof(Board));
+  fenToBoard("7r/3p4/8/8/8/8/4P3/N7 w - - 0 1", b);
   u64 z = getZobrist(b);
   BOOST_CHECK_EQUAL(z,
                     zrBoard[63][BLACK][ROOK] ^
@@ -1453,7 +1565,6 @@ BOOST_AUTO_TEST_CASE(testUpdateZobrist) {
                     zrBoard[0][WHITE][KNIGHT] ^
                     zrSide);
   makeMove(b, m);
-
   free(b);
 }
 
@@ -1476,3 +1587,239 @@ BOOST_AUTO_TEST_CASE(testEgtbHash) {
   BOOST_CHECK_EQUAL(h.contains(81), false);
   BOOST_CHECK_EQUAL(h.contains(99), false);
 }
+
+/************************* Tests for huffman.cpp *************************/
+
+BOOST_AUTO_TEST_CASE(testHuffmanCode) {
+  // Symbol s occurs 2^s times, so an unrestricted code would need 19 bits.
+  static byte in[1 << 20], out[1 << 20], enc[(1 << 20) * HuffmanCode::MAX_BITS / 8 + 4];
+  int n = 0;
+  u64 freq[256] = { 0 };
+  for (int s = 0; s < 20; s++) {
+    for (int i = 0; i < (1 << s); i++) {
+      in[n++] = s * 13; // spread the symbols out
+      freq[s * 13]++;
+    }
+  }
+  for (int i = n - 1; i > 0; i--) {
+    swap(in[i], in[rand() % (i + 1)]);
+  }
+
+  HuffmanCode code;
+  code.build(freq);
+  for (int s = 0; s < 256; s++) {
+    BOOST_CHECK(code.getLengths()[s] <= HuffmanCode::MAX_BITS);
+    BOOST_CHECK_EQUAL(code.getLengths()[s] > 0, freq[s] > 0);
+  }
+  int len = code.encode(in, n, enc);
+  BOOST_CHECK(len < n / 2); // the frequent symbols take 1-2 bits
+
+  // Decode with a code rebuilt from the lengths, as when reading a file.
+  HuffmanCode code2;
+  code2.setLengths(code.getLengths());
+  code2.decode(enc, n, out);
+  BOOST_CHECK(!memcmp(in, out, n));
+
+  // A lone symbol still gets a code.
+  memset(freq, 0, sizeof(freq));
+  freq[200] = 10;
+  code.build(freq);
+  BOOST_CHECK_EQUAL(code.getLengths()[200], 1);
+  memset(in, 200, 10);
+  BOOST_CHECK_EQUAL(code.encode(in, 10, enc), 2);
+  code.decode(enc, 10, out);
+  BOOST_CHECK(!memcmp(in, out, 10));
+}
+
+/************************* Tests for score_cache.cpp *************************/
+
+BOOST_AUTO_TEST_CASE(testScoreCache) {
+  ScoreCache sc(1); // 131072 slots
+  int score;
+  BOOST_CHECK(!sc.get(0x123456789abcdef0ull, &score));
+  sc.put(0x123456789abcdef0ull, -17);
+  BOOST_CHECK(sc.get(0x123456789abcdef0ull, &score));
+  BOOST_CHECK_EQUAL(score, -17);
+  sc.put(0x1234567800000000ull, 0);
+  BOOST_CHECK(sc.get(0x1234567800000000ull, &score));
+  BOOST_CHECK_EQUAL(score, 0);
+
+  // Same slot, different key: a miss, then the new key replaces the old one.
+  BOOST_CHECK(!sc.get(0xf23456789abcdef0ull, &score));
+  sc.put(0xf23456789abcdef0ull, 120);
+  BOOST_CHECK(sc.get(0xf23456789abcdef0ull, &score));
+  BOOST_CHECK_EQUAL(score, 120);
+  BOOST_CHECK(!sc.get(0x123456789abcdef0ull, &score));
+}
+
+/************************* Tests for trans_table.cpp *************************/
+
+BOOST_AUTO_TEST_CASE(testTransTable) {
+  TransTable tt(10); // 16 slots
+  BOOST_CHECK(!tt.find(0x1234));
+
+  // Three keys with the same home slot, plus one for the slot after.
+  tt.insert(0x1005, 1, NIL);
+  tt.insert(0x2005, 2, NIL);
+  tt.insert(0x3005, 3, 30);
+  tt.insert(0x0006, 4, NIL);
+  BOOST_CHECK_EQUAL(tt.size(), 4);
+  BOOST_CHECK_EQUAL(tt.find(0x3005)->orig, 3);
+  BOOST_CHECK_EQUAL(tt.find(0x3005)->clone, 30);
+  tt.find(0x2005)->clone = 20;
+
+  // Deleting the head of the run must not break the lookups after it.
+  tt.erase(tt.find(0x1005));
+  BOOST_CHECK(!tt.find(0x1005));
+  BOOST_CHECK_EQUAL(tt.find(0x2005)->orig, 2);
+  BOOST_CHECK_EQUAL(tt.find(0x2005)->clone, 20);
+  BOOST_CHECK_EQUAL(tt.find(0x3005)->orig, 3);
+  BOOST_CHECK_EQUAL(tt.find(0x0006)->orig, 4);
+  BOOST_CHECK_EQUAL(tt.size(), 3);
+
+  tt.clear();
+  BOOST_CHECK(!tt.find(0x2005));
+  BOOST_CHECK_EQUAL(tt.size(), 0);
+
+  // The table grows as needed.
+  for (int i = 0; i < 100; i++) {
+    tt.insert(0x1000 * i + 5, i, NIL);
+  }
+  BOOST_CHECK_EQUAL(tt.size(), 100);
+  BOOST_CHECK_EQUAL(tt.memory(), 256 * (sizeof(TransEntry) + 1));
+  for (int i = 0; i < 100; i++) {
+    BOOST_CHECK_EQUAL(tt.find(0x1000 * i + 5)->orig, i);
+  }
+
+  // Clearing must keep working when the generation counter wraps around.
+  for (int i = 0; i < 600; i++) {
+    tt.clear();
+    BOOST_CHECK(!tt.find(0x1000 * (i % 100) + 5));
+    tt.insert(0x1000 * (i % 100) + 5, i, NIL);
+    BOOST_CHECK_EQUAL(tt.find(0x1000 * (i % 100) + 5)->orig, i);
+  }
+
+  // reserve() stops when the budget runs out. Each doubling costs as much
+  // as the table already takes.
+  u64 budget = 256 * (sizeof(TransEntry) + 1);
+  BOOST_CHECK(!tt.reserve(1000, &budget));
+  BOOST_CHECK_EQUAL(budget, 0);
+  BOOST_CHECK_EQUAL(tt.memory(), 512 * (sizeof(TransEntry) + 1));
+
+  // reserve() grows the table only once, keeping the contents.
+  BOOST_CHECK(tt.reserve(1000, NULL));
+  BOOST_CHECK_EQUAL(tt.memory(), 2048 * (sizeof(TransEntry) + 1));
+  BOOST_CHECK_EQUAL(tt.find(0x1000 * 99 + 5)->orig, 599);
+  BOOST_CHECK(tt.reserve(1000, NULL));
+  BOOST_CHECK_EQUAL(tt.memory(), 2048 * (sizeof(TransEntry) + 1));
+
+  // findOrInsertBefore() stays within its range and leaves the count to the caller.
+  TransTable tr(10); // 16 slots
+  bool inserted;
+  BOOST_CHECK_EQUAL(tr.home(0x1006), 6);
+  BOOST_CHECK_EQUAL(tr.capacity(), 16);
+  BOOST_CHECK_EQUAL(tr.findOrInsertBefore(0x1006, 1, 8, &inserted)->orig, 1);
+  BOOST_CHECK(inserted);
+  BOOST_CHECK_EQUAL(tr.findOrInsertBefore(0x2006, 2, 8, &inserted)->orig, 2);
+  BOOST_CHECK(inserted);
+  BOOST_CHECK(!tr.findOrInsertBefore(0x3006, 3, 8, &inserted));
+  BOOST_CHECK_EQUAL(tr.findOrInsertBefore(0x2006, 4, 8, &inserted)->orig, 2);
+  BOOST_CHECK(!inserted);
+  BOOST_CHECK_EQUAL(tr.size(), 0);
+  tr.addCount(2);
+  tr.insert(0x3006, 3, NIL);
+  BOOST_CHECK_EQUAL(tr.size(), 3);
+  BOOST_CHECK_EQUAL(tr.find(0x3006)->orig, 3);
+  BOOST_CHECK_EQUAL(tr.find(0x1006)->orig, 1);
+}
+
+/************************* Tests for block_allocator.cpp *************************/
+
+BOOST_AUTO_TEST_CASE(testBlockAllocator) {
+  int *a;
+  BlockAllocator ba("test", (void**)&a, sizeof(int), 10, 5);
+  BOOST_CHECK_EQUAL(ba.alloc(3), 0);
+  BOOST_CHECK_EQUAL(ba.alloc(5), 3);
+  BOOST_CHECK_EQUAL(ba.used(), 8);
+  BOOST_CHECK_EQUAL(ba.available(), 2);
+
+  // Freed blocks are reused for requests of the same size.
+  ba.free(0, 3);
+  BOOST_CHECK_EQUAL(ba.available(), 5);
+  BOOST_CHECK_EQUAL(ba.alloc(2), 8);
+  BOOST_CHECK_EQUAL(ba.alloc(3), 0);
+
+  // Once the array is exhausted, larger free blocks are split.
+  ba.free(3, 5);
+  BOOST_CHECK_EQUAL(ba.alloc(2), 3);
+  BOOST_CHECK_EQUAL(ba.alloc(3), 5);
+  BOOST_CHECK_EQUAL(ba.used(), 10);
+  BOOST_CHECK_EQUAL(ba.available(), 0);
+
+  // Free blocks are not merged, so fragmented space cannot serve larger
+  // requests.
+  ba.free(3, 2);
+  ba.free(8, 2);
+  BOOST_CHECK_EQUAL(ba.available(), 4);
+  BOOST_CHECK_EQUAL(ba.alloc(3), NIL);
+  BOOST_CHECK_EQUAL(ba.alloc(2), 8);
+
+  // With the array at its maximum, reserve() looks for a large enough block.
+  BOOST_CHECK(ba.reserve(2, NULL));
+  BOOST_CHECK(!ba.reserve(3, NULL));
+
+  ba.reset();
+  BOOST_CHECK_EQUAL(ba.used(), 0);
+  BOOST_CHECK_EQUAL(ba.alloc(5), 0);
+  free(a);
+}
+
+/************************* Tests for allocator.cpp *************************/
+
+BOOST_AUTO_TEST_CASE(testAllocatorGrowth) {
+  int *a;
+  Allocator al("test", (void**)&a, sizeof(int), 100000);
+  BOOST_CHECK_EQUAL(al.available(), 100000);
+
+  // Fill past the initial size. The contents must survive the growth.
+  for (int i = 0; i < 70000; i++) {
+    BOOST_CHECK_EQUAL(al.alloc(), i);
+    a[i] = 3 * i;
+  }
+  BOOST_CHECK_EQUAL(a[12345], 3 * 12345);
+  BOOST_CHECK_EQUAL(a[69999], 3 * 69999);
+  BOOST_CHECK_EQUAL(al.used(), 70000);
+  BOOST_CHECK_EQUAL(al.available(), 30000);
+
+  al.free(500);
+  BOOST_CHECK(!al.isInUse(500));
+  BOOST_CHECK_EQUAL(al.alloc(), 500);
+
+  al.reset();
+  BOOST_CHECK(!al.isInUse(69999));
+  BOOST_CHECK_EQUAL(al.alloc(), 0);
+
+  // Resetting must keep working when the generation counter wraps around.
+  for (int i = 0; i < 600; i++) {
+    al.alloc();
+    al.reset();
+    BOOST_CHECK(!al.isInUse(0));
+    BOOST_CHECK(!al.isInUse(1));
+  }
+  free(a);
+
+  // Under a budget, the array grows as far as the budget allows, then stops
+  // growing for good.
+  int *b;
+  Allocator bl("test", (void**)&b, sizeof(int), 1000000);
+  u64 perElement = 2 * sizeof(int) + 1;
+  BOOST_CHECK_EQUAL(bl.memory(), 65536 * perElement);
+  u64 budget = 100000 * perElement;
+  BOOST_CHECK(bl.reserve(70000, &budget));
+  BOOST_CHECK_EQUAL(bl.memory(), 131072 * perElement);
+  BOOST_CHECK_EQUAL(budget, 34464 * perElement);
+  BOOST_CHECK(!bl.reserve(200000, &budget));
+  BOOST_CHECK_EQUAL(bl.memory(), 131072 * perElement);
+  BOOST_CHECK_EQUAL(bl.available(), 131072);
+  free(b);
+}
@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defines.h"
+#include "fileutil.h"
+#include "trans_table.h"
+
+TransTable::TransTable(int numKeys) {
+  growLock = NULL;
+  // Keep the load factor under 2/3 so that probe sequences stay short.
+  u64 numSlots = 1;
+  while (numSlots * 2 < (u64)numKeys * 3) {
+    numSlots *= 2;
+  }
+  assert(allocate(numSlots));
+}
+
+TransTable::~TransTable() {
+  if (!mapped) {
+    free(slots);
+    free(stamp);
+  }
+}
+
+void TransTable::setGrowLock(pthread_mutex_t *lock) {
+  growLock = lock;
+}
+
+bool TransTable::allocate(u64 numSlots) {
+  TransEntry *s = (TransEntry*)calloc(numSlots, sizeof(TransEntry));
+  byte *st = (byte*)calloc(numSlots, 1);
+  if (!s || !st) {
+    free(s);
+    free(st);
+    return false;
+  }
+  slots = s;
+  stamp = st;
+  mask = numSlots - 1;
+  generation = 1;
+  count = 0;
+  mapped = false;
+  return true;
+}
+
+TransEntry* TransTable::find(u64 key) {
+  for (u64 i = key & mask; stamp[i] == generation; i = (i + 1) & mask) {
+    if (slots[i].key == key) {
+      return &slots[i];
+    }
+  }
+  return NULL;
+}
+
+bool TransTable::grow() {
+  // Readers on other threads that hold growLock may be using the old slots.
+  if (growLock) {
+    pthread_mutex_lock(growLock);
+  }
+  TransEntry *oldSlots = slots;
+  byte *oldStamp = stamp;
+  byte oldGeneration = generation;
+  bool oldMapped = mapped;
+  u64 oldSize = mask + 1;
+  bool ok = allocate(2 * oldSize);
+  for (u64 i = 0; ok && (i < oldSize); i++) {
+    if (oldStamp[i] == oldGeneration) {
+      insert(oldSlots[i].key, oldSlots[i].orig, oldSlots[i].clone);
+    }
+  }
+  if (ok && !oldMapped) {
+    free(oldSlots);
+    free(oldStamp);
+  } else if (ok) {
+    unmapPages(image, 2 * sizeof(u64) + oldSize * (sizeof(TransEntry) + 1));
+  }
+  if (growLock) {
+    pthread_mutex_unlock(growLock);
+  }
+  return ok;
+}
+
+TransEntry* TransTable::insert(u64 key, int orig, int clone) {
+  if (((u64)(count + 1) * 3 > (mask + 1) * 2) && !grow()) {
+    // Probing still works, only slower, as long as one slot stays empty.
+    assert((u64)count < mask);
+  }
+  u64 i = key & mask;
+  while (stamp[i] == generation) {
+    assert(slots[i].key != key);
+    i = (i + 1) & mask;
+  }
+  slots[i] = { key, orig, clone };
+  stamp[i] = generation;
+  count++;
+  return &slots[i];
+}
+
+u64 TransTable::home(u64 key) {
+  return key & mask;
+}
+
+u64 TransTable::capacity() {
+  return mask + 1;
+}
+
+TransEntry* TransTable::findOrInsertBefore(u64 key, int orig, u64 end, bool *inserted) {
+  u64 i = key & mask;
+  while ((i < end) && (stamp[i] == generation)) {
+    if (slots[i].key == key) {
+      *inserted = false;
+      return &slots[i];
+    }
+    i++;
+  }
+  if (i == end) {
+    return NULL;
+  }
+  slots[i] = { key, orig, NIL };
+  stamp[i] = generation;
+  *inserted = true;
+  return &slots[i];
+}
+
+void TransTable::addCount(int n) {
+  count += n;
+}
+
+bool TransTable::reserve(int numKeys, u64 *budget) {
+  while ((u64)numKeys * 3 > (mask + 1) * 2) {
+    u64 cost = memory(); // doubling adds as much as there is
+    if (budget && (cost > *budget)) {
+      return false;
+    }
+    if (!grow()) {
+      return false;
+    }
+    if (budget) {
+      *budget -= cost;
+    }
+  }
+  return true;
+}
+
+void TransTable::erase(TransEntry *e) {
+  // Move later entries of the run into the hole, unless that would place
+  // them before their home slot.
+  u64 hole = e - slots;
+  for (u64 i = (hole + 1) & mask; stamp[i] == generation; i = (i + 1) & mask) {
+    u64 home = slots[i].key & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      slots[hole] = slots[i];
+      hole = i;
+    }
+  }
+  stamp[hole] = 0;
+  count--;
+}
+
+void TransTable::clear() {
+  // Stamps from older generations read as empty. Wipe them only when the
+  // generation counter wraps around.
+  if (!++generation) {
+    memset(stamp, 0, mask + 1);
+    generation = 1;
+  }
+  count = 0;
+}
+
+int TransTable::size() {
+  return count;
+}
+
+u64 TransTable::memory() {
+  return (mask + 1) * (sizeof(TransEntry) + 1);
+}
+
+void TransTable::write(FILE *f) {
+  u64 header[2] = { mask + 1, (u64)count };
+  fwrite(header, sizeof(u64), 2, f);
+  fwrite(slots, sizeof(TransEntry), mask + 1, f);
+  for (u64 i = 0; i <= mask; i++) {
+    fputc(stamp[i] == generation, f);
+  }
+}
+
+void TransTable::adopt(char *data) {
+  if (!mapped) {
+    free(slots);
+    free(stamp);
+  }
+  image = data;
+  u64 *header = (u64*)data;
+  mask = header[0] - 1;
+  count = header[1];
+  slots = (TransEntry*)(header + 2);
+  stamp = (byte*)(slots + mask + 1);
+  generation = 1;
+  mapped = true;
+}
@@ -0,0 +1,123 @@
+#ifndef __TRANS_TABLE_H__
+#define __TRANS_TABLE_H__
+#include <pthread.h>
+#include <stdio.h>
+#include "defines.h"
+
+/* An entry in the transposition table. See Pns::trans. */
+typedef struct {
+  u64 key;
+  int orig;  // node for transpositions
+  int clone; // node for repetitions, or NIL
+} TransEntry;
+
+/**
+ * A hash table from Zobrist keys to pairs of PNS nodes. It uses linear
+ * probing and doubles when the load factor reaches 2/3. Deletions shift the
+ * following entries back instead of leaving tombstones, so lookups never slow
+ * down as the tree is trimmed. Slots are stamped with the generation in which
+ * they were filled, so clear() only has to start a new generation.
+ */
+class TransTable {
+
+  TransEntry *slots;
+  byte *stamp;     // generation of each slot; other values mean empty
+  byte generation; // current generation, never 0
+  u64 mask;        // number of slots - 1
+  int count;       // number of keys stored
+  bool mapped;     // true iff slots and stamps belong to a file mapping
+  char *image;     // the mapped table passed to adopt(), if mapped
+  pthread_mutex_t *growLock; // held while the table grows, or NULL
+
+  /**
+   * Allocates numSlots empty slots.
+   * @return False if memory runs out. The table is then left as it was.
+   */
+  bool allocate(u64 numSlots);
+
+  /**
+   * Doubles the number of slots and reinserts all the entries.
+   * @return False if memory runs out. The table is then left as it was.
+   */
+  bool grow();
+
+public:
+
+  /* Creates a table with room for numKeys keys before it needs to grow. */
+  TransTable(int numKeys);
+  ~TransTable();
+
+  /**
+   * Makes growth hold the given mutex, so that other threads can read the
+   * table safely while they hold it too.
+   */
+  void setGrowLock(pthread_mutex_t *lock);
+
+  /**
+   * Looks up a key.
+   * @return The key's entry, or NULL if the key is not in the table. The
+   * pointer is valid until the next call to insert(), erase() or clear().
+   */
+  TransEntry* find(u64 key);
+
+  /* Adds a key, which must not already be in the table, and returns its entry. */
+  TransEntry* insert(u64 key, int orig, int clone);
+
+  /* Returns the slot where probing for key starts. */
+  u64 home(u64 key);
+
+  /* Returns the number of slots. */
+  u64 capacity();
+
+  /**
+   * Looks up a key and adds it with the given orig if it is missing, but
+   * probes no further than slot end - 1 and does not wrap around. Does not
+   * count the key in size(); see addCount(). Several threads may call this at
+   * once as long as the home slots of their keys lie in disjoint ranges and
+   * each passes the end of its own range.
+   * @param inserted Set to true iff the key was added.
+   * @return The key's entry, or NULL if every slot up to end was taken.
+   */
+  TransEntry* findOrInsertBefore(u64 key, int orig, u64 end, bool *inserted);
+
+  /* Counts n keys added by findOrInsertBefore() in size(). */
+  void addCount(int n);
+
+  /**
+   * Grows the table, if needed, so that it holds numKeys keys without growing
+   * again.
+   * @param budget If not NULL, the growth may take at most this many bytes,
+   * which are deducted from it.
+   * @return False if the budget or the available memory do not allow it.
+   */
+  bool reserve(int numKeys, u64 *budget);
+
+  /* Deletes an entry returned by find() or insert(). */
+  void erase(TransEntry *e);
+
+  /* Deletes all the entries in constant time (amortized). */
+  void clear();
+
+  /* Returns the number of keys stored. */
+  int size();
+
+  /* Returns the memory taken by the slots and stamps, in bytes. */
+  u64 memory();
+
+  /**
+   * Writes the table in a form that adopt() can use in place: the number of
+   * slots and keys (as u64's), the slots, then one byte per slot, set for
+   * occupied slots.
+   */
+  void write(FILE *f);
+
+  /**
+   * Replaces the contents with a table written by write(), part of a file
+   * mapping. It is copied when the table grows, and then the pages it
+   * occupies alone are unmapped.
+   */
+  void adopt(char *data);
+
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <string.h>
+#include "logging.h"
+#include "worker_pool.h"
+
+/* Argument of WorkerPool::run(). */
+typedef struct {
+  WorkerPool *pool;
+  int index;
+} WorkerPoolArg;
+
+WorkerPool::WorkerPool(int numTasks, void (*task)(void *arg, int i), void *arg) {
+  this->task = task;
+  this->arg = arg;
+  round = 0;
+  this->numTasks = 0;
+  pending = 0;
+  quit = false;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&start, NULL);
+  pthread_cond_init(&done, NULL);
+
+  for (int i = 1; i < numTasks; i++) {
+    WorkerPoolArg *a = new WorkerPoolArg { this, i };
+    pthread_t t;
+    int err = pthread_create(&t, NULL, run, a);
+    if (err) {
+      log(LOG_WARNING, "Cannot start worker thread %d (%s), running %d tasks per round on the main thread.",
+          i, strerror(err), numTasks - i + 1);
+      delete a;
+      break;
+    }
+    thread.push_back(t);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  pthread_mutex_lock(&lock);
+  quit = true;
+  pthread_cond_broadcast(&start);
+  pthread_mutex_unlock(&lock);
+  for (pthread_t t: thread) {
+    pthread_join(t, NULL);
+  }
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&start);
+  pthread_mutex_destroy(&lock);
+}
+
+void* WorkerPool::run(void *arg) {
+  WorkerPoolArg a = *(WorkerPoolArg*)arg;
+  delete (WorkerPoolArg*)arg;
+  a.pool->work(a.index);
+  return NULL;
+}
+
+void WorkerPool::work(int i) {
+  u64 seen = 0;
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (!quit && (round == seen)) {
+      pthread_cond_wait(&start, &lock);
+    }
+    if (quit) {
+      break;
+    }
+    seen = round;
+    bool mine = (i < numTasks);
+    pthread_mutex_unlock(&lock);
+    if (mine) {
+      task(arg, i);
+    }
+    pthread_mutex_lock(&lock);
+    if (mine && !--pending) {
+      pthread_cond_signal(&done);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void WorkerPool::runRound(int n) {
+  int numThreads = thread.size();
+
+  pthread_mutex_lock(&lock);
+  numTasks = n;
+  pending = MAX(MIN(n - 1, numThreads), 0);
+  round++;
+  pthread_cond_broadcast(&start);
+  pthread_mutex_unlock(&lock);
+
+  // Task 0, and any whose thread did not start, run here meanwhile.
+  for (int i = 0; i < n; i++) {
+    if (!i || (i > numThreads)) {
+      task(arg, i);
+    }
+  }
+
+  pthread_mutex_lock(&lock);
+  while (pending) {
+    pthread_cond_wait(&done, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,47 @@
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+#include <pthread.h>
+#include <vector>
+#include "defines.h"
+
+using namespace std;
+
+/**
+ * Persistent threads that run one task each per round. Task i runs on thread
+ * i, except for task 0, which runs on the calling thread. Used by parallel
+ * PN2, which runs one PN1 search per task, and by tree-parallel PN1, which
+ * runs one search thread per task.
+ */
+class WorkerPool {
+  void (*task)(void *arg, int i);
+  void *arg;
+  vector<pthread_t> thread;   // runs task i + 1
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  u64 round;                  // incremented to start a round
+  int numTasks;               // tasks to run in this round
+  int pending;                // threads still running a task in this round
+  bool quit;
+
+  /* Thread entry point. Runs task i once per round. */
+  static void* run(void *arg);
+
+  void work(int i);
+
+public:
+
+  /**
+   * Starts numTasks - 1 threads. If a thread cannot be started, runRound()
+   * runs its task, and those of the threads after it, on the calling thread.
+   * @param task Function to run as task(arg, i) for the i-th task.
+   */
+  WorkerPool(int numTasks, void (*task)(void *arg, int i), void *arg);
+
+  /* Stops and joins the threads. */
+  ~WorkerPool();
+
+  /* Runs tasks 0 to n - 1 in parallel and waits for all of them. */
+  void runRound(int n);
+};
+
+#endif